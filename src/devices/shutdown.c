@@ -4,11 +4,21 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/fpu.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/memtrack.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
@@ -120,6 +130,11 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  fpu_print_stats ();
+  lockstat_print_stats ();
+  palloc_print_stats ();
+  kmem_print_stats ();
+  memtrack_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
 #endif
@@ -128,4 +143,10 @@ print_stats (void)
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  page_print_stats ();
+  frame_print_stats ();
+  swap_print_stats ();
+  zswap_print_stats ();
+#endif
 }
@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
 
 #define ASCII_SLASH 47
@@ -27,6 +28,8 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
@@ -85,6 +88,7 @@ filesys_create (const char *name, off_t initial_size, bool isDirectory)
     file_close(f); 
   }
   dir_close (dir);
+  free (file_name);
   
   return success;
 }
@@ -107,6 +111,7 @@ filesys_open (const char *name)
   if (dir != NULL)
     dir_lookup (dir, parse, &inode);
   dir_close (dir);
+  free (parse);
 
   return file_open (inode);
 }
@@ -283,5 +288,6 @@ char* get_file_name (const char* name)
   if ( strlen(file_name) > 1 && strcmp( &(file_name[strlen(file_name)-1]), "/") == 0 ) 
     memcpy(file_name + strlen(file_name) - 1,"\0",1);
 
+  free (temp);
   return file_name;  
 }
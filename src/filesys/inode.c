@@ -167,11 +167,16 @@ bool extend(struct inode *inode, off_t offset){
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
     list_init (&open_inodes);
+    inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0,
+                                     NULL);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -277,7 +282,7 @@ inode_open (block_sector_t sector)
     }
 
     /* Allocate memory. */
-    inode = calloc (1, sizeof *inode);
+    inode = kmem_cache_alloc (inode_cache);
     if (inode == NULL){
     	return NULL;
     }
@@ -289,6 +294,7 @@ inode_open (block_sector_t sector)
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
+    inode->total_length = 0;
     block_read (fs_device, inode->sector, &inode->data);
     lock_init(&inode->inode_lock);
     ASSERT(inode!=NULL);
@@ -340,7 +346,7 @@ inode_close (struct inode *inode)
     else{
       block_write(fs_device, inode->sector, &inode->data);
     }
-    free (inode); 
+    kmem_cache_free (inode_cache, inode);
   }
   //else
     //printf("open count too high to close\n");
@@ -23,11 +23,22 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   To speed up searches for unset bits in mostly full bitmaps,
+   a second, "summary" array has one bit per element of BITS,
+   which is set when every bit in that element is set.  A search
+   can then skip ELEM_BITS full elements at a time.  The summary
+   is stored right after BITS in the same block of memory.  It is
+   updated along with the bits it summarizes, but not atomically
+   with them: callers that modify a bitmap concurrently must
+   already serialize, since a scan is not atomic with a flip. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary: one bit per full element. */
+    size_t next;        /* Where to start the next next-fit scan. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -69,6 +80,57 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns a bit mask in which the bits actually used in element
+   IDX of B's bits are set to 1 and the rest are set to 0. */
+static inline elem_type
+elem_mask (const struct bitmap *b, size_t idx) 
+{
+  return idx == elem_cnt (b->bit_cnt) - 1 ? last_mask (b) : (elem_type) -1;
+}
+
+/* Returns the number of bytes needed for B's bits and summary,
+   if it has BIT_CNT bits. */
+static inline size_t
+bits_size (size_t bit_cnt) 
+{
+  return byte_cnt (bit_cnt) + byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Updates the summary bit for element IDX of B's bits. */
+static inline void
+update_summary (struct bitmap *b, size_t idx) 
+{
+  if (b->bits[idx] == elem_mask (b, idx))
+    b->full[elem_idx (idx)] |= bit_mask (idx);
+  else
+    b->full[elem_idx (idx)] &= ~bit_mask (idx);
+}
+
+/* Returns the number of 1-bits in X. */
+static inline size_t
+count_ones (elem_type x) 
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Returns a mask of the bits of element IDX that fall within
+   bits START through END, exclusive. */
+static inline elem_type
+range_mask (size_t idx, size_t start, size_t end) 
+{
+  size_t first = idx * ELEM_BITS;
+  elem_type mask = (elem_type) -1;
+
+  if (start > first)
+    mask &= (elem_type) -1 << (start - first);
+  if (end < first + ELEM_BITS)
+    mask &= ((elem_type) 1 << (end - first)) - 1;
+  return mask;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -82,7 +144,9 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (bits_size (bit_cnt));
+      b->full = b->bits + elem_cnt (bit_cnt);
+      b->next = 0;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +169,8 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->bits + elem_cnt (bit_cnt);
+  b->next = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +180,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + bits_size (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -164,6 +230,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -177,6 +244,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -192,6 +260,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -214,18 +283,30 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element's bits are set atomically, a whole element at a
+   time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  if (cnt == 0)
+    return;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++) 
+    {
+      elem_type mask = range_mask (idx, start, end);
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      update_summary (b, idx);
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -233,17 +314,19 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t idx, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
+  if (cnt == 0)
+    return 0;
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    value_cnt += count_ones (b->bits[idx] & range_mask (idx, start, end));
+  return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -251,14 +334,18 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t end = start + cnt;
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
+  if (cnt == 0)
+    return false;
+  for (idx = elem_idx (start); idx <= elem_idx (end - 1); idx++)
+    if ((b->bits[idx] ^ flip) & range_mask (idx, start, end))
       return true;
   return false;
 }
@@ -289,23 +376,78 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first element of B's bits at or after
+   IDX, and before END_IDX, that is not full, or END_IDX if there
+   is none.  Consults only the summary, so it skips up to
+   ELEM_BITS full elements per step. */
+static size_t
+skip_full (const struct bitmap *b, size_t idx, size_t end_idx) 
+{
+  while (idx < end_idx) 
+    {
+      elem_type open = ~b->full[elem_idx (idx)] & range_mask (elem_idx (idx),
+                                                              idx, end_idx);
+      if (open != 0) 
+        {
+          idx = elem_idx (idx) * ELEM_BITS + __builtin_ctzl (open);
+          return idx < end_idx ? idx : end_idx;
+        }
+      idx = (elem_idx (idx) + 1) * ELEM_BITS;
+    }
+  return end_idx;
+}
+
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t end_idx = elem_cnt (end);
+  size_t idx = elem_idx (start);
+  elem_type word;
+
+  if (start >= end)
+    return end;
+  word = (b->bits[idx] ^ flip) & range_mask (idx, start, end);
+  while (word == 0) 
+    {
+      idx = value ? idx + 1 : skip_full (b, idx + 1, end_idx);
+      if (idx >= end_idx)
+        return end;
+      word = (b->bits[idx] ^ flip) & range_mask (idx, start, end);
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (word);
+  return start < end ? start : end;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works a word at a time: finds the next bit set to VALUE, then
+   the first bit in the following CNT that is not, and resumes
+   the search there. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  while (cnt <= b->bit_cnt - start) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t stop;
+
+      start = find_bit (b, start, b->bit_cnt - cnt + 1, value);
+      if (start > b->bit_cnt - cnt)
+        break;
+      stop = find_bit (b, start, start + cnt, !value);
+      if (stop == start + cnt)
+        return start;
+      start = stop;
     }
   return BITMAP_ERROR;
 }
@@ -325,6 +467,29 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but searches next-fit: starting
+   where the previous call through this function left off, and
+   wrapping around to the beginning of B if necessary. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) 
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (b->next > b->bit_cnt)
+    b->next = 0;
+  idx = bitmap_scan (b, b->next, cnt, value);
+  if (idx == BITMAP_ERROR && b->next > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR) 
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -345,8 +510,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t idx;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (idx = 0; idx < elem_cnt (b->bit_cnt); idx++)
+        update_summary (b, idx);
     }
   return success;
 }
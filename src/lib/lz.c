@@ -0,0 +1,157 @@
+#include <lz.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Compressed format.
+
+   The compressed data is a sequence of items, each introduced by
+   a control byte C:
+
+     - If C < 0x80, C + 1 literal bytes follow, to be copied to
+       the output as is.
+
+     - Otherwise, the item is a match: the (C & 0x7f) + 3 bytes
+       that start OFS bytes back in the output are copied to the
+       output, one byte at a time, so that a match may overlap
+       the bytes it produces.  OFS, between 1 and 65535, follows
+       C as two bytes, least significant first.
+
+   The compressor finds matches through a hash table, indexed by
+   a hash of the next three input bytes, that remembers the last
+   position each hash was seen at.  It only ever checks that one
+   candidate, which misses many matches but makes it quick.  A
+   run of zeros, common in memory pages, compresses to about 3
+   bytes per 130. */
+
+#define HASH_BITS 11                    /* Bits in a hash value. */
+#define NO_POS UINT16_MAX               /* Empty hash table entry. */
+#define MIN_MATCH 3                     /* Shortest match encoded. */
+#define MAX_MATCH (0x7f + MIN_MATCH)    /* Longest match encoded. */
+#define MAX_LITERALS 0x80               /* Longest literal run. */
+
+/* Returns the hash table index for the three bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t v = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Appends the CNT literal bytes at SRC to the output at *DST,
+   which ends at DST_END, advancing *DST.  Returns true if
+   successful, false if the output is full. */
+static bool
+emit_literals (uint8_t **dst, uint8_t *dst_end, const uint8_t *src,
+               size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < MAX_LITERALS ? cnt : MAX_LITERALS;
+      if ((size_t) (dst_end - *dst) < chunk + 1)
+        return false;
+      *(*dst)++ = chunk - 1;
+      memcpy (*dst, src, chunk);
+      *dst += chunk;
+      src += chunk;
+      cnt -= chunk;
+    }
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, at most LZ_MAX_INPUT,
+   into the DST_SIZE bytes at DST, using the LZ_WORK_SIZE bytes
+   at WORK as scratch space.  Returns the size of the compressed
+   data, or 0 if it would not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, void *work)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  uint8_t *dst_end = dst + dst_size;
+  uint16_t *table = work;
+  size_t ip = 0;                /* Input position. */
+  size_t literal = 0;           /* Start of pending literals. */
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+
+  memset (table, 0xff, LZ_WORK_SIZE);
+  while (ip + MIN_MATCH <= src_size)
+    {
+      unsigned h = hash3 (src + ip);
+      size_t cand = table[h];
+      size_t len;
+
+      table[h] = ip;
+      if (cand == NO_POS || memcmp (src + cand, src + ip, MIN_MATCH))
+        {
+          ip++;
+          continue;
+        }
+
+      len = MIN_MATCH;
+      while (ip + len < src_size && len < MAX_MATCH
+             && src[cand + len] == src[ip + len])
+        len++;
+
+      if (!emit_literals (&dst, dst_end, src + literal, ip - literal)
+          || dst_end - dst < 3)
+        return 0;
+      *dst++ = 0x80 | (len - MIN_MATCH);
+      *dst++ = (ip - cand) & 0xff;
+      *dst++ = (ip - cand) >> 8;
+      ip += len;
+      literal = ip;
+    }
+
+  if (!emit_literals (&dst, dst_end, src + literal, src_size - literal))
+    return 0;
+  return dst - (uint8_t *) dst_;
+}
+
+/* Decompresses the SRC_SIZE bytes of compressed data at SRC into
+   the DST_SIZE bytes at DST.  Returns the number of bytes of
+   output, or LZ_ERROR if SRC is malformed or its output would
+   not fit in DST_SIZE bytes. */
+size_t
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size)
+{
+  const uint8_t *src = src_;
+  const uint8_t *src_end = src + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *dst_end = dst + dst_size;
+
+  while (src < src_end)
+    {
+      uint8_t c = *src++;
+
+      if (c < 0x80)
+        {
+          size_t cnt = c + 1;
+          if ((size_t) (src_end - src) < cnt
+              || (size_t) (dst_end - dst) < cnt)
+            return LZ_ERROR;
+          memcpy (dst, src, cnt);
+          src += cnt;
+          dst += cnt;
+        }
+      else
+        {
+          size_t len = (c & 0x7f) + MIN_MATCH;
+          size_t ofs;
+
+          if (src_end - src < 2)
+            return LZ_ERROR;
+          ofs = src[0] | (src[1] << 8);
+          src += 2;
+          if (ofs == 0 || ofs > (size_t) (dst - (uint8_t *) dst_)
+              || (size_t) (dst_end - dst) < len)
+            return LZ_ERROR;
+          for (; len > 0; len--, dst++)
+            *dst = dst[-ofs];
+        }
+    }
+  return dst - (uint8_t *) dst_;
+}
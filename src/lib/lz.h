@@ -0,0 +1,24 @@
+#ifndef __LIB_LZ_H
+#define __LIB_LZ_H
+
+/* A small, fast LZ77-style compressor, meant for compressing
+   pages of memory rather than for a good compression ratio. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bytes of scratch memory that lz_compress() needs. */
+#define LZ_WORK_SIZE (2048 * sizeof (uint16_t))
+
+/* Largest input that lz_compress() accepts, in bytes. */
+#define LZ_MAX_INPUT 65535
+
+/* Returned by lz_decompress() for malformed input. */
+#define LZ_ERROR SIZE_MAX
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+                      void *dst, size_t dst_size);
+
+#endif /* lib/lz.h */
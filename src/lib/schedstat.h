@@ -0,0 +1,25 @@
+#ifndef __LIB_SCHEDSTAT_H
+#define __LIB_SCHEDSTAT_H
+
+#include <stdint.h>
+
+/* Scheduler statistics for a single thread, kept by the kernel
+   and returned by the schedstat() system call.
+
+   Times are in CPU timestamp counter cycles.  Bucket I of each
+   histogram counts events that took from 2**I to 2**(I+1) - 1
+   cycles; bucket 0 also counts events that took 0 cycles. */
+#define SCHEDSTAT_BUCKETS 32
+
+struct schedstat
+  {
+    uint64_t run_cycles;        /* Total time spent running. */
+    uint64_t max_latency;       /* Longest wait from ready to running. */
+    uint32_t dispatches;        /* Times the thread was switched in. */
+    uint32_t voluntary;         /* Switches out to block, sleep or exit. */
+    uint32_t involuntary;       /* Switches out by preemption or yield. */
+    uint32_t latency[SCHEDSTAT_BUCKETS]; /* Ready-to-running waits. */
+    uint32_t runs[SCHEDSTAT_BUCKETS];    /* Lengths of single runs. */
+  };
+
+#endif /* lib/schedstat.h */
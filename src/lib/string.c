@@ -1,5 +1,73 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below move data a 32-bit word at a time,
+   using the x86 string instructions where they fit.  Blocks
+   shorter than WORD_MIN bytes are not worth the setup and are
+   handled a byte at a time.  Words are read and written through
+   a may_alias type, since they overlay data of any type. */
+#define WORD_MIN 16
+typedef uint32_t word_t __attribute__ ((may_alias));
+
+/* Returns a word with every byte equal to the low byte of C. */
+static inline uint32_t
+word_fill (int c) 
+{
+  return (unsigned char) c * 0x01010101u;
+}
+
+/* Returns nonzero if any byte in W is zero. */
+static inline uint32_t
+word_has_zero (uint32_t w) 
+{
+  return (w - 0x01010101u) & ~w & 0x80808080u;
+}
+
+/* Copies SIZE bytes from SRC to DST in ascending address order.
+   Aligns DST to a word boundary, then copies words with
+   "rep movsl" and the remaining bytes with "rep movsb". */
+static inline void
+copy_up (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  if (size >= WORD_MIN) 
+    {
+      size_t head = -(uintptr_t) dst & 3;
+      size_t words = (size - head) / 4;
+      size = (size - head) % 4;
+      asm volatile ("rep movsb"
+                    : "+D" (dst), "+S" (src), "+c" (head) : : "memory");
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+    }
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (size) : : "memory");
+}
+
+/* Copies SIZE bytes from SRC to DST in descending address order,
+   for overlapping moves with DST above SRC. */
+static inline void
+copy_down (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  dst += size;
+  src += size;
+  if (size >= WORD_MIN) 
+    {
+      while ((uintptr_t) dst & 3) 
+        {
+          *--dst = *--src;
+          size--;
+        }
+      for (; size >= 4; size -= 4) 
+        {
+          dst -= 4;
+          src -= 4;
+          *(word_t *) dst = *(const word_t *) src;
+        }
+    }
+  while (size-- > 0)
+    *--dst = *--src;
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,8 +80,7 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  copy_up (dst, src, size);
 
   return dst_;
 }
@@ -29,20 +96,15 @@ memmove (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  if (dst < src) 
-    {
-      while (size-- > 0)
-        *dst++ = *src++;
-    }
-  else 
-    {
-      dst += size;
-      src += size;
-      while (size-- > 0)
-        *--dst = *--src;
-    }
+  /* Copying upward is safe whenever DST is below SRC, even if
+     the blocks overlap, since every word is read before the
+     copy can overwrite it. */
+  if (dst <= src || dst >= src + size)
+    copy_up (dst, src, size);
+  else
+    copy_down (dst, src, size);
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -58,6 +120,10 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip over equal words, then find the differing byte. */
+  for (; size >= 4; a += 4, b += 4, size -= 4)
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -282,6 +348,21 @@ memset (void *dst_, int value, size_t size)
 
   ASSERT (dst != NULL || size == 0);
   
+  if (size >= WORD_MIN) 
+    {
+      uint32_t fill = word_fill (value);
+      size_t words;
+
+      while ((uintptr_t) dst & 3) 
+        {
+          *dst++ = value;
+          size--;
+        }
+      words = size / 4;
+      size %= 4;
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (fill) : "memory");
+    }
   while (size-- > 0)
     *dst++ = value;
 
@@ -296,8 +377,16 @@ strlen (const char *string)
 
   ASSERT (string != NULL);
 
-  for (p = string; *p != '\0'; p++)
-    continue;
+  /* Check bytes up to a word boundary, then whole words.  An
+     aligned word never straddles a page boundary, so reading a
+     few bytes past the terminator cannot fault. */
+  for (p = string; (uintptr_t) p & 3; p++)
+    if (*p == '\0')
+      return p - string;
+  while (!word_has_zero (*(const word_t *) p))
+    p += 4;
+  while (*p != '\0')
+    p++;
   return p - string;
 }
 
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+schedstat (pid_t pid, struct schedstat *stats) 
+{
+  return syscall2 (SYS_SCHEDSTAT, pid, stats);
+}
+
+pid_t
+fork (void)
+{
+  return syscall0 (SYS_FORK);
+}
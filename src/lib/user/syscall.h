@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <schedstat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +46,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool schedstat (pid_t, struct schedstat *);
+pid_t fork (void);
+
 #endif /* lib/user/syscall.h */
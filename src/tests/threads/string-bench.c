@@ -0,0 +1,202 @@
+/* Checks the block functions in lib/string.c against plain byte
+   loops at every combination of alignments and a range of
+   lengths, including overlapping memmove() in both directions.
+   Then times each function against its byte loop on page-sized
+   blocks, to show what the word-at-a-time versions buy. */
+
+#include <stdio.h>
+#include <string.h>
+#include <random.h>
+#include "tests/threads/tests.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Largest length checked for correctness. */
+#define CHECK_MAX 80
+
+/* Size of buffers used for checking. */
+#define CHECK_SIZE (CHECK_MAX + 64)
+
+/* Number of repetitions for each timing. */
+#define BENCH_ITERS 64
+
+/* Results of timed calls, kept so they are not optimized away. */
+static volatile size_t sink;
+
+static void check (void);
+static void bench (void);
+
+void
+test_string_bench (void) 
+{
+  msg ("checking block functions");
+  check ();
+  bench ();
+  pass ();
+}
+
+/* Reference byte-at-a-time implementations. */
+
+static void __attribute__ ((noinline))
+byte_copy (unsigned char *dst, const unsigned char *src, size_t size) 
+{
+  if (dst <= src)
+    while (size-- > 0)
+      *dst++ = *src++;
+  else
+    while (size-- > 0)
+      dst[size] = src[size];
+}
+
+static void __attribute__ ((noinline))
+byte_set (unsigned char *dst, int value, size_t size) 
+{
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+static int __attribute__ ((noinline))
+byte_cmp (const unsigned char *a, const unsigned char *b, size_t size) 
+{
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static size_t __attribute__ ((noinline))
+byte_len (const char *s) 
+{
+  const char *p;
+
+  for (p = s; *p != '\0'; p++)
+    continue;
+  return p - s;
+}
+
+/* Returns the sign of X. */
+static int
+sign (int x) 
+{
+  return (x > 0) - (x < 0);
+}
+
+static void
+check (void) 
+{
+  static unsigned char src[CHECK_SIZE], a[CHECK_SIZE], b[CHECK_SIZE];
+  size_t src_ofs, dst_ofs, size;
+
+  for (src_ofs = 0; src_ofs < 8; src_ofs++)
+    for (dst_ofs = 0; dst_ofs < 8; dst_ofs++)
+      for (size = 0; size <= CHECK_MAX; size++) 
+        {
+          size_t i;
+
+          /* memcpy(). */
+          random_bytes (src, sizeof src);
+          random_bytes (a, sizeof a);
+          memcpy (b, a, sizeof b);
+          if (memcpy (a + dst_ofs, src + src_ofs, size) != a + dst_ofs)
+            fail ("memcpy returned wrong pointer");
+          byte_copy (b + dst_ofs, src + src_ofs, size);
+          if (byte_cmp (a, b, sizeof a))
+            fail ("memcpy of %zu bytes from offset %zu to offset %zu "
+                  "is wrong", size, src_ofs, dst_ofs);
+
+          /* memmove(), with the source and destination overlapping
+             downward and upward. */
+          for (i = 0; i < 2; i++) 
+            {
+              unsigned char *dst = a + dst_ofs + (i ? 8 : 0);
+              unsigned char *from = a + src_ofs + (i ? 0 : 8);
+
+              memcpy (b, a, sizeof b);
+              if (memmove (dst, from, size) != dst)
+                fail ("memmove returned wrong pointer");
+              byte_copy (b + (dst - a), b + (from - a), size);
+              if (byte_cmp (a, b, sizeof a))
+                fail ("memmove of %zu bytes from offset %zu to offset %zu "
+                      "is wrong", size, from - a, dst - a);
+            }
+
+          /* memset(). */
+          if (memset (a + dst_ofs, src_ofs * 37, size) != a + dst_ofs)
+            fail ("memset returned wrong pointer");
+          byte_set (b + dst_ofs, src_ofs * 37, size);
+          if (byte_cmp (a, b, sizeof a))
+            fail ("memset of %zu bytes at offset %zu is wrong",
+                  size, dst_ofs);
+
+          /* memcmp(), with and without a difference. */
+          memcpy (a, src, sizeof a);
+          if (memcmp (a + src_ofs, src + src_ofs, size) != 0)
+            fail ("memcmp of %zu equal bytes is nonzero", size);
+          if (size > 0)
+            a[src_ofs + random_ulong () % size] ^= 1 + random_ulong () % 255;
+          if (sign (memcmp (a + src_ofs, src + src_ofs, size))
+              != sign (byte_cmp (a + src_ofs, src + src_ofs, size)))
+            fail ("memcmp of %zu bytes at offset %zu is wrong",
+                  size, src_ofs);
+
+          /* strlen(). */
+          byte_set (a, 'x', sizeof a);
+          a[src_ofs + size] = '\0';
+          if (strlen ((char *) a + src_ofs) != size)
+            fail ("strlen of %zu-byte string at offset %zu is wrong",
+                  size, src_ofs);
+        }
+}
+
+/* Times BENCH_ITERS runs of EXPR, with interrupts off, and
+   returns the average number of cycles per run. */
+#define TIME(EXPR)                                      \
+        ({                                              \
+          enum intr_level old_level = intr_disable ();  \
+          uint64_t start = rdtsc ();                    \
+          int iter;                                     \
+          for (iter = 0; iter < BENCH_ITERS; iter++)    \
+            EXPR;                                       \
+          start = rdtsc () - start;                     \
+          intr_set_level (old_level);                   \
+          (unsigned long long) start / BENCH_ITERS;     \
+        })
+
+/* Prints the cycles taken by a function and its byte loop. */
+static void
+report (const char *name, unsigned long long bytes,
+        unsigned long long word, unsigned long long byte) 
+{
+  msg ("%s %llu bytes: byte loop %llu cycles, lib %llu cycles",
+       name, bytes, byte, word);
+}
+
+static void
+bench (void) 
+{
+  unsigned char *a = palloc_get_multiple (PAL_ASSERT, 2);
+  unsigned char *b = a + PGSIZE;
+
+  random_bytes (a, PGSIZE);
+  memcpy (b, a, PGSIZE);
+  report ("memcpy", PGSIZE,
+          TIME (memcpy (b, a, PGSIZE)), TIME (byte_copy (b, a, PGSIZE)));
+  report ("memmove", PGSIZE - 4,
+          TIME (memmove (a + 4, a, PGSIZE - 4)),
+          TIME (byte_copy (a + 4, a, PGSIZE - 4)));
+  report ("memset", PGSIZE,
+          TIME (memset (a, 0, PGSIZE)), TIME (byte_set (a, 0, PGSIZE)));
+  memset (b, 0, PGSIZE);
+  report ("memcmp", PGSIZE,
+          TIME (sink = memcmp (a, b, PGSIZE)),
+          TIME (sink = byte_cmp (a, b, PGSIZE)));
+  memset (a, 'x', PGSIZE - 1);
+  a[PGSIZE - 1] = '\0';
+  report ("strlen", PGSIZE - 1,
+          TIME (sink = strlen ((char *) a)),
+          TIME (sink = byte_len ((char *) a)));
+
+  palloc_free_multiple (a, 2);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# Timings vary from run to run, so only their presence is
+# checked.
+my ($timings) = scalar (grep (/^\(string-bench\) \S+ \d+ bytes: /, @output));
+fail "Expected 5 timing lines, got $timings\n" if $timings != 5;
+@output = grep (!/^\(string-bench\) \S+ \d+ bytes: /, @output);
+compare_output ("run", \@output, [<<'EOF2']);
+(string-bench) begin
+(string-bench) checking block functions
+(string-bench) PASS
+(string-bench) end
+EOF2
+pass;
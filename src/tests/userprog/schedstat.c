@@ -0,0 +1,25 @@
+/* Gets the process's scheduler statistics into a buffer that
+   spans two pages, which must succeed, then into read-only code,
+   which must terminate the process with exit code -1. */
+
+#include <schedstat.h>
+#include <syscall.h>
+#include "tests/userprog/boundary.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct schedstat *stats;
+
+  stats = (struct schedstat *) ((char *) get_boundary_area ()
+                                - sizeof *stats / 2);
+  CHECK (schedstat (0, stats), "schedstat into a writable buffer");
+  if (stats->dispatches == 0)
+    fail ("process was never dispatched");
+
+  msg ("schedstat into read-only memory");
+  schedstat (0, (struct schedstat *) test_main);
+  fail ("should not have survived schedstat()");
+}
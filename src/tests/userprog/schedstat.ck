@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(schedstat) begin
+(schedstat) schedstat into a writable buffer
+(schedstat) schedstat into read-only memory
+schedstat: exit(-1)
+EOF
+pass;
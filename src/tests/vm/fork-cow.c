@@ -0,0 +1,55 @@
+/* Forks a child that overwrites a global buffer and a stack
+   buffer it shares copy-on-write with its parent, including via
+   a read() system call, and checks that the parent's copies are
+   unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (3 * 4096)
+
+static char global[SIZE];
+
+void
+test_main (void)
+{
+  char local[4096];
+  pid_t child;
+  size_t i;
+
+  memset (global, 'p', sizeof global);
+  memset (local, 'p', sizeof local);
+
+  /* The child must stay silent, since its output would race with
+     the parent's. */
+  child = fork ();
+  if (child == 0)
+    {
+      int handle;
+
+      memset (global, 'c', 4096);
+      memset (local, 'c', sizeof local);
+      handle = open ("sample.txt");
+      if (handle < 2 || read (handle, global + 4096, 512) != 512)
+        exit (1);
+      for (i = 0; i < 4096; i++)
+        if (global[i] != 'c' || local[i] != 'c')
+          exit (2);
+      for (i = 2 * 4096; i < SIZE; i++)
+        if (global[i] != 'p')
+          exit (3);
+      exit (81);
+    }
+
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 81, "wait for child (should return 81)");
+  for (i = 0; i < SIZE; i++)
+    if (global[i] != 'p')
+      fail ("parent's global[%zu] changed to '%c'", i, global[i]);
+  for (i = 0; i < sizeof local; i++)
+    if (local[i] != 'p')
+      fail ("parent's local[%zu] changed to '%c'", i, local[i]);
+  msg ("parent's memory unchanged");
+}
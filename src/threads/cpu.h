@@ -0,0 +1,74 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdint.h>
+
+/* Helpers for CPU feature detection and control registers. */
+
+/* CR0 bits.  See [IA32-v3a] 2.5 "Control Registers". */
+#define CR0_MP 0x00000002       /* Monitor coprocessor. */
+#define CR0_EM 0x00000004       /* Emulation. */
+#define CR0_TS 0x00000008       /* Task switched. */
+#define CR0_NE 0x00000020       /* Numeric error reporting via #MF. */
+
+/* CR4 bits. */
+#define CR4_PSE 0x00000010      /* 4 MB pages. */
+#define CR4_PGE 0x00000080      /* Global pages. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE/FXRSTOR and SSE enabled. */
+#define CR4_OSXMMEXCPT 0x00000400 /* SSE exceptions reported via #XF. */
+
+/* CPUID.1:EDX feature bits.  See [IA32-v2a] "CPUID". */
+#define CPUID_PSE 0x00000008    /* 4 MB pages. */
+#define CPUID_PGE 0x00002000    /* Global pages. */
+#define CPUID_FXSR 0x01000000   /* FXSAVE/FXRSTOR. */
+#define CPUID_SSE 0x02000000    /* SSE. */
+
+/* Returns the feature flags in EDX reported by CPUID leaf 1. */
+static inline uint32_t
+cpu_features (void) 
+{
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return edx;
+}
+
+static inline uint32_t
+read_cr0 (void) 
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0) 
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+static inline uint32_t
+read_cr4 (void) 
+{
+  uint32_t cr4;
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  return cr4;
+}
+
+static inline void
+write_cr4 (uint32_t cr4) 
+{
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+}
+
+/* Returns the CPU's timestamp counter.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+rdtsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* threads/cpu.h */
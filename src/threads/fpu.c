@@ -0,0 +1,238 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Lazy FPU context switching.
+
+   switch_threads() saves only the integer registers.  Instead of
+   also saving and restoring the x87/MMX/SSE registers on every
+   switch, we leave them in the CPU and set CR0.TS whenever a
+   thread other than their owner is running.  The first FPU or
+   SSE instruction such a thread executes then raises #NM
+   (Device Not Available), and only at that point do we save the
+   owner's registers and load the new thread's.
+
+   A thread gets a save area the first time it uses the FPU, so a
+   thread that never does costs nothing beyond the null `fpu'
+   pointer in its struct thread, and switching between such
+   threads never touches CR0 once TS is set. */
+
+/* Save area sizes and alignment: FXSAVE needs 512 bytes aligned
+   on a 16-byte boundary, FSAVE 108 bytes. */
+#define FXSAVE_SIZE 512
+#define FSAVE_SIZE 108
+#define FPU_ALIGN 16
+
+/* Default MXCSR: all SSE exceptions masked, round to nearest. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* True if the CPU supports FXSAVE/FXRSTOR. */
+static bool have_fxsr;
+
+/* True if the CPU supports SSE (and hence MXCSR). */
+static bool have_sse;
+
+/* Thread whose state is currently loaded in the FPU, or null. */
+static struct thread *fpu_owner;
+
+/* Mirrors CR0.TS, so that we can avoid reading CR0. */
+static bool ts_set;
+
+/* Statistics. */
+static long long fpu_traps;     /* # of #NM traps handled. */
+static long long fpu_saves;     /* # of times an owner's state was saved. */
+
+static void fpu_trap (struct intr_frame *);
+
+/* Sets CR0.TS, so that the next FPU instruction traps. */
+static inline void
+set_ts (void) 
+{
+  write_cr0 (read_cr0 () | CR0_TS);
+  ts_set = true;
+}
+
+/* Clears CR0.TS.  See [IA32-v2a] "CLTS". */
+static inline void
+clear_ts (void) 
+{
+  asm volatile ("clts");
+  ts_set = false;
+}
+
+/* Returns T's save area, aligned as FXSAVE requires. */
+static inline void *
+fpu_area (struct thread *t) 
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu, FPU_ALIGN);
+}
+
+/* Enables the FPU and the #NM handler.  Must be called after
+   intr_init() and before any thread other than the initial one
+   runs. */
+void
+fpu_init (void) 
+{
+  uint32_t features = cpu_features ();
+
+  have_fxsr = (features & CPUID_FXSR) != 0;
+  have_sse = have_fxsr && (features & CPUID_SSE) != 0;
+  if (have_fxsr)
+    write_cr4 (read_cr4 () | CR4_OSFXSR
+               | (have_sse ? CR4_OSXMMEXCPT : 0));
+
+  /* start.S set EM so that any FPU instruction trapped.  Replace
+     that with MP and TS, which trap only until we have loaded
+     the running thread's FPU state. */
+  write_cr0 ((read_cr0 () & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+  ts_set = true;
+
+  intr_register_int (7, 0, INTR_ON, fpu_trap,
+                     "#NM Device Not Available Exception");
+}
+
+/* Called by thread_schedule_tail() with interrupts off each time
+   CUR is switched in.  Clears TS if CUR's state is already in the
+   FPU and sets it otherwise, touching CR0 only if TS must
+   actually change. */
+void
+fpu_switch (struct thread *cur) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cur == fpu_owner)
+    {
+      if (ts_set)
+        clear_ts ();
+    }
+  else if (!ts_set)
+    set_ts ();
+}
+
+/* Releases T's FPU state.  Called by thread_exit(). */
+void
+fpu_exit (struct thread *t) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (fpu_owner == t)
+    fpu_owner = NULL;
+  intr_set_level (old_level);
+
+  free (t->fpu);
+  t->fpu = NULL;
+}
+
+/* Gives the running thread a copy of FROM's FPU state, for
+   fork().  FROM must not run until this returns.  Returns true
+   if successful, false if memory allocation failed. */
+bool
+fpu_copy (struct thread *from) 
+{
+  struct thread *cur = thread_current ();
+  size_t size = have_fxsr ? FXSAVE_SIZE : FSAVE_SIZE;
+  enum intr_level old_level;
+
+  ASSERT (cur->fpu == NULL);
+  if (from->fpu == NULL)
+    return true;
+  cur->fpu = malloc (size + FPU_ALIGN - 1);
+  if (cur->fpu == NULL)
+    return false;
+
+  old_level = intr_disable ();
+  if (fpu_owner == from) 
+    {
+      /* FROM's registers are still in the FPU.  Save them, and
+         since FNSAVE also reinitializes the FPU, let FROM load
+         them again the next time it needs them. */
+      clear_ts ();
+      if (have_fxsr)
+        asm volatile ("fxsave %0" : "=m" (*(char (*)[FXSAVE_SIZE])
+                                          fpu_area (from)));
+      else
+        asm volatile ("fnsave %0" : "=m" (*(char (*)[FSAVE_SIZE])
+                                          fpu_area (from)));
+      fpu_saves++;
+      fpu_owner = NULL;
+      set_ts ();
+    }
+  memcpy (fpu_area (cur), fpu_area (from), size);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Prints FPU statistics. */
+void
+fpu_print_stats (void) 
+{
+  printf ("FPU: %lld lazy restores, %lld saves\n", fpu_traps, fpu_saves);
+}
+
+/* #NM handler.  Loads the running thread's FPU state, saving the
+   previous owner's first, allocating a fresh save area if this
+   is the thread's first FPU instruction. */
+static void
+fpu_trap (struct intr_frame *f UNUSED) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool fresh = false;
+
+  if (cur->fpu == NULL) 
+    {
+      /* May sleep, so do it before touching the FPU. */
+      cur->fpu = malloc ((have_fxsr ? FXSAVE_SIZE : FSAVE_SIZE)
+                         + FPU_ALIGN - 1);
+      if (cur->fpu == NULL) 
+        {
+          printf ("%s: out of memory for FPU state\n", thread_name ());
+          thread_exit ();
+        }
+      fresh = true;
+    }
+
+  old_level = intr_disable ();
+  fpu_traps++;
+  clear_ts ();
+  if (fpu_owner != NULL && fpu_owner != cur) 
+    {
+      /* See [IA32-v2a] "FXSAVE" and "FSAVE". */
+      if (have_fxsr)
+        asm volatile ("fxsave %0" : "=m" (*(char (*)[FXSAVE_SIZE])
+                                          fpu_area (fpu_owner)));
+      else
+        asm volatile ("fnsave %0" : "=m" (*(char (*)[FSAVE_SIZE])
+                                          fpu_area (fpu_owner)));
+      fpu_saves++;
+    }
+
+  if (fresh) 
+    {
+      uint32_t mxcsr = MXCSR_DEFAULT;
+      asm volatile ("fninit");
+      if (have_sse)
+        asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  else if (fpu_owner != cur) 
+    {
+      /* See [IA32-v2a] "FXRSTOR" and "FRSTOR". */
+      if (have_fxsr)
+        asm volatile ("fxrstor %0" : : "m" (*(char (*)[FXSAVE_SIZE])
+                                            fpu_area (cur)));
+      else
+        asm volatile ("frstor %0" : : "m" (*(char (*)[FSAVE_SIZE])
+                                           fpu_area (cur)));
+    }
+  fpu_owner = cur;
+  intr_set_level (old_level);
+}
@@ -15,10 +15,13 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/cpu.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
@@ -28,6 +31,12 @@
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -98,6 +107,7 @@ main (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  memtrack_init ();
   malloc_init ();
   paging_init ();
 
@@ -109,16 +119,23 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  fpu_init ();
   timer_init ();
   kbd_init ();
   input_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  process_init ();
+#ifdef VM
+  page_init ();
+  frame_init ();
+#endif
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  palloc_start_zeroer ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -128,6 +145,10 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
   thread_initmore(); //ADDED
+#ifdef VM
+  swap_init ();
+  frame_start_pager ();
+#endif
 
 #endif
 
@@ -157,13 +178,28 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports global pages, the kernel mappings are
+   marked global, so that they stay in the TLB when CR3 is
+   reloaded to switch between user address spaces.  That is safe
+   because the kernel mappings are identical in every page
+   directory and never change after this point.
+
+   If the CPU supports 4 MB pages, each 4 MB region that lies
+   wholly within RAM and holds no kernel text is mapped with a
+   single large-page PDE instead of a page table.  That saves the
+   page table and, more importantly, 1023 TLB entries per region.
+   Kernel text stays in 4 kB pages so that it can be read-only. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t features = cpu_features ();
+  bool global = (features & CPUID_PGE) != 0;
+  bool large = (features & CPUID_PSE) != 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -175,13 +211,24 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (large && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = (pde_create_large (vaddr, true)
+                         | (global ? PTE_G : 0));
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = (pte_create_kernel (vaddr, !in_kernel_text)
+                     | (global ? PTE_G : 0));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -189,7 +236,14 @@ paging_init (void)
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
+  if (large)
+    write_cr4 (read_cr4 () | CR4_PSE);
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Honor the PTE_G bits set above.  See [IA32-v3a] 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  if (global)
+    write_cr4 (read_cr4 () | CR4_PGE);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -254,15 +308,25 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-stack"))
+        page_stack_limit = (size_t) atoi (value) * 1024;
+      else if (!strcmp (name, "-zswap"))
+        zswap_limit = atoi (value);
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-lockstat"))
+        lockstat_enabled = true;
+      else if (!strcmp (name, "-memtrack"))
+        memtrack_enabled = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-largepages"))
+        user_large_pages = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -379,12 +443,17 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -stack=KB          Limit each process's stack to KB kB.\n"
+          "  -zswap=PAGES       Keep compressed swap in up to PAGES pages.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -lockstat          Report lock contention at shutdown.\n"
+          "  -memtrack          Track kernel memory by call site.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -largepages        Map big read-only segments with 4 MB pages.\n"
 #endif
           );
   shutdown_power_off ();
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
+#include "threads/memtrack.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,7 +34,19 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Hot, fixed-size kernel objects can instead come from an object
+   cache created with kmem_cache_create().  A cache carves
+   single-page "slabs" into objects of exactly the requested size
+   (rounded up only to the requested alignment), so a 20-byte
+   object does not burn a 32-byte block.  Each slab keeps its own
+   free list and the cache keeps a list of slabs that still have
+   free objects.  In front of the slabs sits a small "magazine"
+   of recently freed objects that can be handed out again with
+   only interrupts disabled, without touching the cache lock.
+   When the page allocator runs short, it asks the caches to
+   empty their magazines and give back their free slabs. */
 
 /* Descriptor. */
 struct desc
@@ -51,9 +65,46 @@ struct arena
   {
     unsigned magic;             /* Always set to ARENA_MAGIC. */
     struct desc *desc;          /* Owning descriptor, null for big block. */
+    struct kmem_cache *cache;   /* Owning object cache, if a slab. */
     size_t free_cnt;            /* Free blocks; pages in big block. */
   };
 
+/* Number of objects held in a cache's magazine. */
+#define MAG_SIZE 16
+
+/* Object cache. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in cache_list. */
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t first_ofs;           /* Offset of first object in a slab. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct list partial;        /* Slabs with at least one free object. */
+    struct slab *empty;         /* One completely free slab, or null. */
+    struct lock lock;           /* Protects slabs. */
+
+    /* Magazine, protected by disabling interrupts. */
+    void *mag[MAG_SIZE];        /* Recently freed objects. */
+    size_t mag_cnt;             /* Number of objects in MAG. */
+
+    /* Statistics. */
+    unsigned long long allocs;  /* Objects handed out. */
+    unsigned long long frees;   /* Objects given back. */
+    unsigned long long mag_hits; /* Allocations served by MAG. */
+    size_t slab_cnt;            /* Slabs currently allocated. */
+    size_t slab_peak;           /* Maximum of SLAB_CNT. */
+  };
+
+/* Slab: a one-page arena owned by an object cache. */
+struct slab
+  {
+    struct arena arena;         /* Arena header, DESC is null. */
+    struct list_elem elem;      /* Element in cache's PARTIAL list. */
+    void *free_objs;            /* Singly linked list of free objects. */
+  };
+
 /* Free block. */
 struct block 
   {
@@ -64,8 +115,21 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* All object caches, for statistics. */
+static struct list cache_list;
+
+/* Kind of block, for memtrack. */
+static const char malloc_kind[] = "malloc";
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *do_malloc (size_t);
+static void do_free (void *);
+static size_t block_size (void *);
+static void *cache_alloc (struct kmem_cache *);
+static void cache_free (struct kmem_cache *, void *);
+static bool slab_put (struct kmem_cache *, void *);
+static palloc_reclaim_func kmem_reclaim;
 
 /* Initializes the malloc() descriptors. */
 void
@@ -82,12 +146,25 @@ malloc_init (void)
       list_init (&d->free_list);
       lock_init (&d->lock);
     }
+  list_init (&cache_list);
+  palloc_add_reclaim (kmem_reclaim);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  void *p = do_malloc (size);
+  if (p != NULL)
+    memtrack_alloc (malloc_kind, p, block_size (p),
+                    __builtin_return_address (0));
+  return p;
+}
+
+/* Does the work of malloc(), without tracking. */
+static void *
+do_malloc (size_t size) 
 {
   struct desc *d;
   struct block *b;
@@ -115,6 +192,7 @@ malloc (size_t size)
          pages, and return it. */
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
+      a->cache = NULL;
       a->free_cnt = page_cnt;
       return a + 1;
     }
@@ -137,6 +215,7 @@ malloc (size_t size)
       /* Initialize arena and add its blocks to the free list. */
       a->magic = ARENA_MAGIC;
       a->desc = d;
+      a->cache = NULL;
       a->free_cnt = d->blocks_per_arena;
       for (i = 0; i < d->blocks_per_arena; i++) 
         {
@@ -167,9 +246,13 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
-  if (p != NULL)
-    memset (p, 0, size);
+  p = do_malloc (size);
+  if (p != NULL) 
+    {
+      memset (p, 0, size);
+      memtrack_alloc (malloc_kind, p, block_size (p),
+                      __builtin_return_address (0));
+    }
 
   return p;
 }
@@ -182,6 +265,8 @@ block_size (void *block)
   struct arena *a = block_to_arena (b);
   struct desc *d = a->desc;
 
+  if (a->cache != NULL)
+    return a->cache->obj_size;
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
@@ -194,29 +279,50 @@ block_size (void *block)
 void *
 realloc (void *old_block, size_t new_size) 
 {
+  void *site = __builtin_return_address (0);
+
   if (new_size == 0) 
     {
-      free (old_block);
+      if (old_block != NULL)
+        memtrack_free (malloc_kind, old_block, site);
+      do_free (old_block);
       return NULL;
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = do_malloc (new_size);
+      if (new_block != NULL)
+        memtrack_alloc (malloc_kind, new_block, block_size (new_block),
+                        site);
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
-          free (old_block);
+          memtrack_free (malloc_kind, old_block, site);
+          do_free (old_block);
         }
       return new_block;
     }
 }
 
 /* Frees block P, which must have been previously allocated with
-   malloc(), calloc(), or realloc(). */
+   malloc(), calloc(), or realloc(), or from an object cache. */
 void
 free (void *p) 
+{
+  if (p != NULL)
+    {
+      struct arena *a = block_to_arena (p);
+      memtrack_free (a->cache != NULL ? a->cache->name : malloc_kind, p,
+                     __builtin_return_address (0));
+      do_free (p);
+    }
+}
+
+/* Does the work of free(), without tracking. */
+static void
+do_free (void *p) 
 {
   if (p != NULL)
     {
@@ -224,7 +330,9 @@ free (void *p)
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
       
-      if (d != NULL) 
+      if (a->cache != NULL)
+        cache_free (a->cache, p);
+      else if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
 
@@ -263,6 +371,284 @@ free (void *p)
     }
 }
 
+/* Creates and returns an object cache named NAME for objects of
+   SIZE bytes aligned on ALIGN-byte boundaries, which must be a
+   power of 2 (0 selects word alignment).  If CTOR is nonnull, it
+   is called on each object as it is taken from a slab; objects
+   recycled through the magazine are handed out again as they
+   were freed.  Panics if memory is not available, since caches
+   are created at boot time. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+
+  if (align < sizeof (void *))
+    align = sizeof (void *);
+  ASSERT ((align & (align - 1)) == 0);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("kmem_cache_create: out of memory for %s", name);
+  c->name = name;
+  c->obj_size = ROUND_UP (size, align);
+  c->first_ofs = ROUND_UP (sizeof (struct slab), align);
+  ASSERT (c->first_ofs + c->obj_size <= PGSIZE);
+  c->objs_per_slab = (PGSIZE - c->first_ofs) / c->obj_size;
+  c->ctor = ctor;
+  list_init (&c->partial);
+  c->empty = NULL;
+  lock_init (&c->lock);
+  c->mag_cnt = 0;
+  c->allocs = c->frees = c->mag_hits = 0;
+  c->slab_cnt = c->slab_peak = 0;
+  list_push_back (&cache_list, &c->elem);
+  return c;
+}
+
+/* Allocates a new slab for cache C and threads its objects onto
+   the slab's free list.  Returns a null pointer if memory is not
+   available.  C's lock must be held. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->arena.magic = ARENA_MAGIC;
+  s->arena.desc = NULL;
+  s->arena.cache = c;
+  s->arena.free_cnt = c->objs_per_slab;
+  s->free_objs = NULL;
+  for (i = c->objs_per_slab; i-- > 0; )
+    {
+      void **obj = (void **) ((uint8_t *) s + c->first_ofs
+                              + i * c->obj_size);
+      *obj = s->free_objs;
+      s->free_objs = obj;
+    }
+  if (++c->slab_cnt > c->slab_peak)
+    c->slab_peak = c->slab_cnt;
+  return s;
+}
+
+/* Obtains and returns an object from cache C.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  void *p = cache_alloc (c);
+  if (p != NULL)
+    memtrack_alloc (c->name, p, c->obj_size, __builtin_return_address (0));
+  return p;
+}
+
+/* Does the work of kmem_cache_alloc(), without tracking. */
+static void *
+cache_alloc (struct kmem_cache *c)
+{
+  enum intr_level old_level;
+  struct slab *s;
+  void **obj;
+
+  /* Fast path: reuse a recently freed object. */
+  old_level = intr_disable ();
+  if (c->mag_cnt > 0)
+    {
+      obj = c->mag[--c->mag_cnt];
+      c->allocs++;
+      c->mag_hits++;
+      intr_set_level (old_level);
+      return obj;
+    }
+  intr_set_level (old_level);
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else 
+    {
+      if (c->empty != NULL)
+        {
+          s = c->empty;
+          c->empty = NULL;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  /* Take an object off the slab, retiring the slab from the
+     partial list once it is full. */
+  obj = s->free_objs;
+  s->free_objs = *obj;
+  if (--s->arena.free_cnt == 0)
+    list_remove (&s->elem);
+  c->allocs++;
+  lock_release (&c->lock);
+
+  if (c->ctor != NULL)
+    c->ctor (obj);
+  return obj;
+}
+
+/* Returns object P, which must have been obtained from cache C,
+   to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *p)
+{
+  if (p != NULL) 
+    {
+      memtrack_free (c->name, p, __builtin_return_address (0));
+      cache_free (c, p);
+    }
+}
+
+/* Does the work of kmem_cache_free(), without tracking. */
+static void
+cache_free (struct kmem_cache *c, void *p)
+{
+  enum intr_level old_level;
+
+  if (p == NULL)
+    return;
+  ASSERT (block_to_arena (p)->cache == c);
+
+#ifndef NDEBUG
+  /* Clear the object to help detect use-after-free bugs.  Objects
+     with a constructor must stay constructed. */
+  if (c->ctor == NULL)
+    memset (p, 0xcc, c->obj_size);
+#endif
+
+  /* Fast path: park the object in the magazine. */
+  old_level = intr_disable ();
+  c->frees++;
+  if (c->mag_cnt < MAG_SIZE)
+    {
+      c->mag[c->mag_cnt++] = p;
+      intr_set_level (old_level);
+      return;
+    }
+  intr_set_level (old_level);
+
+  lock_acquire (&c->lock);
+  slab_put (c, p);
+  lock_release (&c->lock);
+}
+
+/* Returns object P to its slab in cache C.  Returns true if that
+   freed the slab's page.  C's lock must be held. */
+static bool
+slab_put (struct kmem_cache *c, void *p)
+{
+  struct slab *s = (struct slab *) block_to_arena (p);
+  void **obj = p;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  *obj = s->free_objs;
+  s->free_objs = obj;
+  if (s->arena.free_cnt++ == 0)
+    list_push_front (&c->partial, &s->elem);
+  if (s->arena.free_cnt == c->objs_per_slab)
+    {
+      /* Keep one free slab around to absorb alloc/free churn at
+         a slab boundary; give any other back to the page
+         allocator. */
+      list_remove (&s->elem);
+      if (c->empty == NULL)
+        c->empty = s;
+      else
+        {
+          c->slab_cnt--;
+          palloc_free_page (s);
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Page allocator reclaim function: empties every object cache's
+   magazine back into its slabs and frees the slabs that end up
+   completely free, including each cache's spare empty slab.
+   Caches whose lock is busy, or held by our own caller, are
+   skipped.  Returns the number of pages freed. */
+static size_t
+kmem_reclaim (enum palloc_flags flags UNUSED, size_t page_cnt UNUSED)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      void *mag[MAG_SIZE];
+      enum intr_level old_level;
+      size_t mag_cnt, i;
+
+      if (lock_held_by_current_thread (&c->lock)
+          || !lock_try_acquire (&c->lock))
+        continue;
+
+      old_level = intr_disable ();
+      mag_cnt = c->mag_cnt;
+      memcpy (mag, c->mag, mag_cnt * sizeof *mag);
+      c->mag_cnt = 0;
+      intr_set_level (old_level);
+
+      for (i = 0; i < mag_cnt; i++)
+        if (slab_put (c, mag[i]))
+          freed++;
+      if (c->empty != NULL)
+        {
+          c->slab_cnt--;
+          palloc_free_page (c->empty);
+          c->empty = NULL;
+          freed++;
+        }
+      lock_release (&c->lock);
+    }
+  return freed;
+}
+
+/* Prints statistics for each object cache. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e))
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      unsigned long long in_use = c->allocs - c->frees;
+
+      printf ("Cache %s: %zu-byte objects, %zu per slab, "
+              "%zu slabs (peak %zu), %llu in use, "
+              "%llu allocs (%llu from magazine), %llu frees\n",
+              c->name, c->obj_size, c->objs_per_slab,
+              c->slab_cnt, c->slab_peak, in_use,
+              c->allocs, c->mag_hits, c->frees);
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -276,7 +662,9 @@ block_to_arena (struct block *b)
   /* Check that the block is properly aligned for the arena. */
   ASSERT (a->desc == NULL
           || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+  ASSERT (a->cache == NULL
+          || (pg_ofs (b) - a->cache->first_ofs) % a->cache->obj_size == 0);
+  ASSERT (a->desc != NULL || a->cache != NULL || pg_ofs (b) == sizeof *a);
 
   return a;
 }
@@ -10,4 +10,13 @@ void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+/* Object caches. */
+struct kmem_cache;
+typedef void kmem_ctor_func (void *);
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *) __attribute__ ((malloc));
+void kmem_cache_free (struct kmem_cache *, void *);
+void kmem_print_stats (void);
+
 #endif /* threads/malloc.h */
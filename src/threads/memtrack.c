@@ -0,0 +1,288 @@
+#include "threads/memtrack.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Kernel memory tracker.
+
+   With -memtrack, malloc(), the object caches and the page
+   allocator report every allocation and free here, together with
+   the address of the code that asked for it.  Each live block is
+   recorded in a hash table keyed by its address, which lets us
+   charge it to its allocation site, give its bytes back to that
+   site when it is freed, and catch frees of blocks that are not
+   live, such as double frees.
+
+   Statistics are kept per call site and per "kind", which is the
+   allocator the block came from: "malloc", "palloc", "palloc
+   user", or the name of an object cache.  Kinds roughly follow
+   kernel subsystems, since each hot object type has its own
+   cache.
+
+   Nothing here may allocate memory, so the tables are carved out
+   of pages taken from the page allocator at boot.  Everything is
+   protected by disabling interrupts, because pages are freed from
+   thread_schedule_tail(). */
+
+bool memtrack_enabled;
+
+/* Pages set aside for live block records. */
+#define RECORD_PAGES 32
+
+/* Number of hash buckets for live block records. */
+#define BUCKET_CNT 1024
+
+/* Maximum number of (site, kind) pairs tracked. */
+#define SITE_CNT 256
+
+/* Number of sites printed at shutdown. */
+#define TOP_SITES 12
+
+/* Statistics for one call site and kind. */
+struct site
+  {
+    void *eip;                  /* Return address of allocator call. */
+    const char *kind;           /* Allocator. */
+    size_t live_bytes;          /* Bytes allocated and not freed. */
+    size_t live_cnt;            /* Blocks allocated and not freed. */
+    size_t peak_bytes;          /* Maximum of LIVE_BYTES. */
+    unsigned long long allocs;  /* Total allocations. */
+  };
+
+/* A live block. */
+struct record
+  {
+    struct record *next;        /* Next in bucket or free list. */
+    void *addr;                 /* Address of block. */
+    size_t size;                /* Size of block in bytes. */
+    const char *kind;           /* Allocator. */
+    struct site *site;          /* Allocating site. */
+  };
+
+static struct record **buckets;         /* Hash table of live blocks. */
+static struct record *free_records;     /* Unused records. */
+static struct site sites[SITE_CNT];     /* Sites seen so far. */
+static size_t site_cnt;                 /* Number of SITES in use. */
+static struct site other_site;          /* Sites beyond SITE_CNT. */
+
+static size_t live_bytes;               /* Total live bytes. */
+static size_t peak_bytes;               /* Maximum of LIVE_BYTES. */
+static unsigned long long untracked;    /* Allocations with no record. */
+static unsigned long long unknown_frees; /* Frees of unrecorded blocks. */
+
+/* Sets up the tracker's tables if -memtrack was given.  Must be
+   called after palloc_init() and before anything else
+   allocates memory. */
+void
+memtrack_init (void) 
+{
+  struct record *r;
+  size_t i, cnt;
+
+  if (!memtrack_enabled)
+    return;
+
+  /* Switch tracking off while we take our own pages. */
+  memtrack_enabled = false;
+  buckets = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                                 DIV_ROUND_UP (BUCKET_CNT * sizeof *buckets,
+                                               PGSIZE));
+  r = palloc_get_multiple (PAL_ASSERT, RECORD_PAGES);
+  cnt = RECORD_PAGES * PGSIZE / sizeof *r;
+  for (i = 0; i < cnt; i++) 
+    {
+      r[i].next = free_records;
+      free_records = &r[i];
+    }
+  memtrack_enabled = true;
+}
+
+/* Returns the hash bucket for block address P. */
+static struct record **
+bucket (void *p) 
+{
+  return &buckets[((uintptr_t) p >> 4) % BUCKET_CNT];
+}
+
+/* Returns the statistics for allocations of KIND made at EIP.
+   Interrupts must be off. */
+static struct site *
+find_site (const char *kind, void *eip) 
+{
+  size_t i;
+
+  for (i = 0; i < site_cnt; i++)
+    if (sites[i].eip == eip && sites[i].kind == kind)
+      return &sites[i];
+  if (site_cnt >= SITE_CNT)
+    return &other_site;
+  sites[site_cnt].eip = eip;
+  sites[site_cnt].kind = kind;
+  return &sites[site_cnt++];
+}
+
+/* Records that the code at SITE obtained the SIZE-byte block P
+   from the allocator named KIND. */
+void
+memtrack_alloc (const char *kind, void *p, size_t size, void *site) 
+{
+  enum intr_level old_level;
+  struct record *r;
+  struct site *s;
+
+  if (!memtrack_enabled || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  r = free_records;
+  if (r != NULL) 
+    {
+      free_records = r->next;
+      s = find_site (kind, site);
+      r->addr = p;
+      r->size = size;
+      r->kind = kind;
+      r->site = s;
+      r->next = *bucket (p);
+      *bucket (p) = r;
+
+      s->allocs++;
+      s->live_cnt++;
+      s->live_bytes += size;
+      if (s->live_bytes > s->peak_bytes)
+        s->peak_bytes = s->live_bytes;
+      live_bytes += size;
+      if (live_bytes > peak_bytes)
+        peak_bytes = live_bytes;
+    }
+  else
+    untracked++;
+  intr_set_level (old_level);
+}
+
+/* Records that the code at SITE gave block P back to the
+   allocator named KIND.  Panics if P is not a live block from
+   KIND, which usually means it is being freed twice, unless some
+   allocations went unrecorded. */
+void
+memtrack_free (const char *kind, void *p, void *site) 
+{
+  enum intr_level old_level;
+  struct record **rp, *r;
+
+  if (!memtrack_enabled || p == NULL)
+    return;
+
+  old_level = intr_disable ();
+  for (rp = bucket (p); *rp != NULL; rp = &(*rp)->next)
+    if ((*rp)->addr == p)
+      break;
+  r = *rp;
+  if (r == NULL || r->kind != kind) 
+    {
+      if (untracked == 0)
+        PANIC ("memtrack: %s block %p freed at %p is not allocated "
+               "(double free?)", kind, p, site);
+      unknown_frees++;
+      intr_set_level (old_level);
+      return;
+    }
+
+  *rp = r->next;
+  r->site->live_cnt--;
+  r->site->live_bytes -= r->size;
+  live_bytes -= r->size;
+  r->next = free_records;
+  free_records = r;
+  intr_set_level (old_level);
+}
+
+/* Prints one site's statistics. */
+static void
+print_site (const struct site *s) 
+{
+  printf ("  %p %-12s %8zu bytes live in %5zu blocks, "
+          "peak %zu, %llu allocs\n",
+          s->eip, s->kind, s->live_bytes, s->live_cnt,
+          s->peak_bytes, s->allocs);
+}
+
+/* qsort() comparison function that puts sites with more live
+   bytes first. */
+static int
+compare_live_bytes (const void *a_, const void *b_)
+{
+  const struct site *a = a_;
+  const struct site *b = b_;
+
+  return (a->live_bytes < b->live_bytes) - (a->live_bytes > b->live_bytes);
+}
+
+/* Prints live memory by kind and the call sites holding the most
+   memory, if -memtrack was given.  Sites are code addresses; use
+   the `backtrace' utility to translate them to source lines. */
+void
+memtrack_print_stats (void) 
+{
+  static struct site snapshot[SITE_CNT];
+  static const char *kinds[SITE_CNT];
+  enum intr_level old_level;
+  size_t cnt, kind_cnt, i, j;
+  size_t total, peak;
+  unsigned long long lost, unknown;
+
+  if (!memtrack_enabled)
+    return;
+
+  old_level = intr_disable ();
+  cnt = site_cnt;
+  memcpy (snapshot, sites, cnt * sizeof *snapshot);
+  total = live_bytes;
+  peak = peak_bytes;
+  lost = untracked;
+  unknown = unknown_frees;
+  intr_set_level (old_level);
+
+  printf ("Memtrack: %zu bytes live, peak %zu", total, peak);
+  if (lost > 0)
+    printf (", %llu allocations and %llu frees untracked", lost, unknown);
+  printf ("\n");
+
+  /* Totals per kind. */
+  kind_cnt = 0;
+  for (i = 0; i < cnt; i++) 
+    {
+      for (j = 0; j < kind_cnt; j++)
+        if (kinds[j] == snapshot[i].kind)
+          break;
+      if (j == kind_cnt)
+        kinds[kind_cnt++] = snapshot[i].kind;
+    }
+  for (j = 0; j < kind_cnt; j++) 
+    {
+      size_t bytes = 0, blocks = 0;
+      for (i = 0; i < cnt; i++)
+        if (snapshot[i].kind == kinds[j]) 
+          {
+            bytes += snapshot[i].live_bytes;
+            blocks += snapshot[i].live_cnt;
+          }
+      printf ("  %-12s %8zu bytes live in %5zu blocks\n",
+              kinds[j], bytes, blocks);
+    }
+
+  qsort (snapshot, cnt, sizeof *snapshot, compare_live_bytes);
+  printf ("Memtrack: top sites by live bytes\n");
+  for (i = 0; i < cnt && i < TOP_SITES; i++)
+    if (snapshot[i].live_bytes > 0)
+      print_site (&snapshot[i]);
+  if (other_site.allocs > 0)
+    printf ("  other sites: %zu bytes live in %zu blocks\n",
+            other_site.live_bytes, other_site.live_cnt);
+}
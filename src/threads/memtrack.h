@@ -0,0 +1,16 @@
+#ifndef THREADS_MEMTRACK_H
+#define THREADS_MEMTRACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* If true, track every kernel allocation by call site.
+   Controlled by kernel command-line option "-memtrack". */
+extern bool memtrack_enabled;
+
+void memtrack_init (void);
+void memtrack_alloc (const char *kind, void *p, size_t size, void *site);
+void memtrack_free (const char *kind, void *p, void *site);
+void memtrack_print_stats (void);
+
+#endif /* threads/memtrack.h */
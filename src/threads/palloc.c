@@ -2,13 +2,18 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/memtrack.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -21,27 +26,144 @@
    that the kernel needs to have memory for its own operations
    even if user processes are swapping like mad.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   The pools do not own fixed ranges of memory.  All free pages
+   sit in one "zone" that both pools draw from, and a pool is
+   just a count of the pages charged to it plus two watermarks.
+   A pool may always grow to its low watermark, which is the
+   memory guaranteed to it, and may borrow free pages beyond
+   that up to its high watermark as long as it leaves enough
+   free pages for the other pool to reach its own low watermark.
+   By default each pool is guaranteed a quarter of memory and
+   may grow into the rest, so a machine busy with kernel caches
+   or with many processes can use nearly all of RAM.  The -ul
+   option caps the user pool's high watermark.
 
-/* A memory pool. */
+   When a pool cannot take the pages it wants, the allocator
+   calls the reclaim functions registered with
+   palloc_add_reclaim(), such as the object caches' function that
+   gives back their empty slabs, and tries again.
+
+   The zone is managed as a binary buddy system.  Free memory is
+   kept as blocks of 2**ORDER pages, each aligned (relative to
+   the zone base) on a multiple of its own size, on one free list
+   per order.  A request for N pages takes a block of the
+   smallest order that fits, splitting larger blocks as needed,
+   and hands the unused tail of the block straight back.  Freeing
+   merges a block with its "buddy" for as long as the buddy is
+   also free.  Both directions take O(log n) time.
+
+   Block indexes are counted from the 4 MB boundary at or below
+   the start of the zone, with the pages before the zone's real
+   start permanently allocated, so that any block of up to 4 MB
+   is aligned on a multiple of its size in physical memory too.
+   That lets a 1024-page block back a 4 MB large page.
+
+   The free list element of a free block lives in its first
+   page, and an array with one byte per page records the order
+   of each free block's first page.  A second such array records
+   which pool each allocated block is charged to.  All of this is
+   short enough to run with interrupts disabled, which also lets
+   pages be freed from thread_schedule_tail().
+
+   Single-page PAL_ZERO requests are usually served from a small
+   reserve of pages that a low-priority kernel thread zeroes
+   ahead of time.  Single pages that are freed while the reserve
+   is short are parked on a "dirty" list instead of going back to
+   the buddy system, and the zeroing thread recycles them into
+   the reserve.  Either list is drained back into the buddy
+   system if an allocation would otherwise fail. */
+
+/* Number of block orders.  The largest block is 2**(ORDERS - 1)
+   pages, which is more than any zone we will ever see. */
+#define ORDERS 16
+
+/* Value in the zone's order map for a page that does not begin
+   a free block. */
+#define ORDER_NONE 0xff
+
+/* Pre-zeroed page reserve. */
+#define ZERO_MAX 32             /* Pages kept zeroed or dirty. */
+#define ZERO_LOW 8              /* Wake the zeroer below this. */
+
+/* Maximum number of registered reclaim functions. */
+#define RECLAIM_MAX 8
+
+/* Number of times an allocation calls the reclaim functions
+   before giving up. */
+#define RECLAIM_TRIES 3
+
+/* A memory pool: the pages charged to one kind of use. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    const char *name;                   /* Name, for statistics. */
+    size_t used;                        /* Pages charged to the pool. */
+    size_t peak;                        /* Maximum of USED. */
+    size_t low;                         /* Pages guaranteed to the pool. */
+    size_t high;                        /* Most pages the pool may use. */
+    unsigned long long reclaims;        /* Times reclaim was needed. */
+    unsigned long long failures;        /* Allocations that failed. */
+  };
+
+/* Two pools: one for kernel data, one for user pages.  The values
+   stored in the zone's owner map index this array. */
+enum { KERNEL_POOL, USER_POOL };
+static struct pool pools[2];
+
+/* All free memory, shared by the pools. */
+struct zone
+  {
     struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    uint8_t *order_map;                 /* Order of each free block. */
+    uint8_t *owner_map;                 /* Pool of each allocated block. */
+    uint8_t *base;                      /* Base of zone. */
+    size_t page_cnt;                    /* Number of pages from BASE. */
+    size_t first_idx;                   /* Index of first real page. */
+    struct list free[ORDERS];           /* Free blocks, by order. */
+    size_t free_cnt[ORDERS];            /* Length of each free list. */
+    size_t free_pages;                  /* Pages on the free lists. */
+
+    /* Pre-zeroed pages.  Pages on these lists are allocated as
+       far as the buddy system and USED_MAP are concerned, but are
+       not charged to either pool. */
+    void *zeroed[ZERO_MAX];             /* Pages filled with zeros. */
+    size_t zeroed_cnt;                  /* Number of ZEROED pages. */
+    void *dirty[ZERO_MAX];              /* Freed pages to be zeroed. */
+    size_t dirty_cnt;                   /* Number of DIRTY pages. */
+    unsigned long long zero_hits;       /* PAL_ZERO served by ZEROED. */
+    unsigned long long zero_misses;     /* PAL_ZERO zeroed in place. */
   };
 
-/* Two pools: one for kernel data, one for user pages. */
-static struct pool kernel_pool, user_pool;
+static struct zone zone;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
-static bool page_from_pool (const struct pool *, void *page);
+/* Functions that give memory back under pressure. */
+static palloc_reclaim_func *reclaimers[RECLAIM_MAX];
+static size_t reclaimer_cnt;
+
+/* Upped to wake page_zeroer() when the reserve runs low. */
+static struct semaphore zero_low;
+static bool zeroer_started;
+
+static void init_pool (struct pool *, const char *name,
+                       size_t low, size_t high);
+static size_t init_zone (void *base, size_t page_cnt);
+static struct pool *page_owner (void *page);
+static bool pool_may_take (const struct pool *, size_t page_cnt);
+static bool run_reclaimers (enum palloc_flags, size_t page_cnt);
+static size_t buddy_alloc (size_t page_cnt);
+static void buddy_free (size_t page_idx, size_t page_cnt);
+static void *take_pages (size_t page_cnt);
+static void give_pages (void *pages, size_t page_cnt);
+static bool reclaim_reserve (void);
+static thread_func page_zeroer NO_RETURN;
+static void *get_pages (enum palloc_flags, size_t page_cnt);
+static void free_pages (void *, size_t page_cnt);
+
+/* Kinds of pages, for memtrack. */
+static const char kernel_kind[] = "palloc";
+static const char user_kind[] = "palloc user";
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
-   pages are put into the user pool. */
+   pages are charged to the user pool. */
 void
 palloc_init (size_t user_page_limit)
 {
@@ -49,50 +171,129 @@ palloc_init (size_t user_page_limit)
   uint8_t *free_start = ptov (1024 * 1024);
   uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
   size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
-  if (user_pages > user_page_limit)
-    user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  size_t page_cnt = init_zone (free_start, free_pages);
+  size_t quarter = page_cnt / 4;
+  size_t user_high = page_cnt - quarter;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  /* Guarantee each pool a quarter of memory and let it borrow up
+     to the rest. */
+  if (user_high > user_page_limit)
+    user_high = user_page_limit;
+  init_pool (&pools[KERNEL_POOL], "kernel pool", quarter, page_cnt);
+  init_pool (&pools[USER_POOL], "user pool",
+             quarter < user_high ? quarter : user_high, user_high);
+}
+
+/* Starts the thread that keeps the pre-zeroed page reserve
+   filled.  It runs at the lowest priority, so pages are zeroed
+   only when nothing else wants the CPU. */
+void
+palloc_start_zeroer (void)
+{
+  sema_init (&zero_low, 1);
+  zeroer_started = true;
+  thread_create ("page-zero", PRI_MIN, page_zeroer, NULL);
+}
+
+/* Registers FUNC to be called when an allocation fails for lack
+   of pages.  FUNC should free what memory it cheaply can and
+   return the number of pages it gave back.  It is called only
+   outside interrupt context, possibly while the caller holds
+   locks, so it must not block on locks it could be holding. */
+void
+palloc_add_reclaim (palloc_reclaim_func *func)
+{
+  ASSERT (reclaimer_cnt < RECLAIM_MAX);
+  reclaimers[reclaimer_cnt++] = func;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
-   If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   If PAL_USER is set, the pages are charged to the user pool,
+   otherwise to the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.
+   If PAGE_CNT is a power of 2 no greater than 1024, the pages
+   are physically aligned on a multiple of PAGE_CNT pages. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
-  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  void *pages = get_pages (flags, page_cnt);
+  memtrack_alloc (flags & PAL_USER ? user_kind : kernel_kind, pages,
+                  PGSIZE * page_cnt, __builtin_return_address (0));
+  return pages;
+}
+
+/* Does the work of palloc_get_multiple(), without tracking. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt)
+{
+  int pool_idx = flags & PAL_USER ? USER_POOL : KERNEL_POOL;
+  struct pool *pool = &pools[pool_idx];
+  enum intr_level old_level;
+  void *pages = NULL;
+  bool zeroed = false;
+  bool low = false;
+  int tries;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  for (tries = 0; ; tries++)
+    {
+      old_level = intr_disable ();
+      if (pool_may_take (pool, page_cnt))
+        {
+          if (page_cnt == 1 && (flags & PAL_ZERO) && zone.zeroed_cnt > 0)
+            {
+              pages = zone.zeroed[--zone.zeroed_cnt];
+              zeroed = true;
+            }
+          else
+            {
+              pages = take_pages (page_cnt);
+              if (pages == NULL && reclaim_reserve ())
+                pages = take_pages (page_cnt);
+            }
+          if (pages != NULL)
+            {
+              size_t page_idx = pg_no (pages) - pg_no (zone.base);
+              zone.owner_map[page_idx] = pool_idx;
+              pool->used += page_cnt;
+              if (pool->used > pool->peak)
+                pool->peak = pool->used;
+            }
+        }
+      if (pages == NULL && tries == 0)
+        pool->reclaims++;
+      intr_set_level (old_level);
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+      if (pages != NULL || tries >= RECLAIM_TRIES
+          || !run_reclaimers (flags, page_cnt))
+        break;
+    }
+
+  if (page_cnt == 1 && (flags & PAL_ZERO))
+    {
+      old_level = intr_disable ();
+      if (zeroed)
+        zone.zero_hits++;
+      else
+        zone.zero_misses++;
+      low = zone.zeroed_cnt < ZERO_LOW;
+      intr_set_level (old_level);
+      if (low && zeroer_started)
+        sema_up (&zero_low);
+    }
 
-  if (pages != NULL) 
+  if (pages != NULL)
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
-  else 
+  else
     {
+      pool->failures++;
       if (flags & PAL_ASSERT)
         PANIC ("palloc_get: out of pages");
     }
@@ -102,81 +303,426 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
 /* Obtains a single free page and returns its kernel virtual
    address.
-   If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   If PAL_USER is set, the page is charged to the user pool,
+   otherwise to the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the page is filled with zeros.  If no pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
-palloc_get_page (enum palloc_flags flags) 
+palloc_get_page (enum palloc_flags flags)
 {
-  return palloc_get_multiple (flags, 1);
+  void *page = get_pages (flags, 1);
+  memtrack_alloc (flags & PAL_USER ? user_kind : kernel_kind, page,
+                  PGSIZE, __builtin_return_address (0));
+  return page;
 }
 
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
-palloc_free_multiple (void *pages, size_t page_cnt) 
+palloc_free_multiple (void *pages, size_t page_cnt)
+{
+  if (pages != NULL)
+    memtrack_free (page_owner (pages) == &pools[USER_POOL]
+                   ? user_kind : kernel_kind,
+                   pages, __builtin_return_address (0));
+  free_pages (pages, page_cnt);
+}
+
+/* Does the work of palloc_free_multiple(), without tracking. */
+static void
+free_pages (void *pages, size_t page_cnt)
 {
+  enum intr_level old_level;
   struct pool *pool;
-  size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
     return;
 
-  if (page_from_pool (&kernel_pool, pages))
-    pool = &kernel_pool;
-  else if (page_from_pool (&user_pool, pages))
-    pool = &user_pool;
-  else
-    NOT_REACHED ();
-
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  pool = page_owner (pages);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  /* Park a single page for the zeroer if the reserve is short,
+     otherwise return the pages to the buddy system. */
+  old_level = intr_disable ();
+  ASSERT (pool->used >= page_cnt);
+  pool->used -= page_cnt;
+  if (page_cnt == 1 && zone.zeroed_cnt + zone.dirty_cnt < ZERO_MAX)
+    zone.dirty[zone.dirty_cnt++] = pages;
+  else
+    give_pages (pages, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
 void
-palloc_free_page (void *page) 
+palloc_free_page (void *page)
 {
-  palloc_free_multiple (page, 1);
+  if (page != NULL)
+    memtrack_free (page_owner (page) == &pools[USER_POOL]
+                   ? user_kind : kernel_kind,
+                   page, __builtin_return_address (0));
+  free_pages (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Initializes POOL with the given NAME and LOW and HIGH
+   watermarks, in pages. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *pool, const char *name, size_t low, size_t high)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  ASSERT (low <= high);
+
+  pool->name = name;
+  pool->used = pool->peak = 0;
+  pool->low = low;
+  pool->high = high;
+  pool->reclaims = pool->failures = 0;
+  printf ("%s: %zu pages guaranteed, up to %zu pages\n", name, low, high);
+}
+
+/* Initializes the zone as the PAGE_CNT pages starting at BASE.
+   Returns the number of pages left for allocation. */
+static size_t
+init_zone (void *base, size_t page_cnt)
+{
+  /* We'll put the zone's used_map, order_map, and owner_map at
+     its base.  Calculate the space needed for them, allowing for
+     up to 4 MB of lead-in before the zone, and subtract it from
+     the zone's size. */
+  size_t max_cnt = page_cnt + PTSPAN / PGSIZE;
+  size_t bm_size = bitmap_buf_size (max_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + 2 * max_cnt, PGSIZE);
+  uint8_t *first;
+  size_t lead;
+  int order;
+
   if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
+    PANIC ("Not enough memory for page allocator bitmap.");
   page_cnt -= bm_pages;
 
-  printf ("%zu pages available in %s.\n", page_cnt, name);
+  printf ("%zu pages available.\n", page_cnt);
+
+  /* Count pages from the 4 MB boundary below the first real
+     page. */
+  first = (uint8_t *) base + bm_pages * PGSIZE;
+  lead = pg_no (first) % (PTSPAN / PGSIZE);
+
+  /* Initialize the zone. */
+  zone.used_map = bitmap_create_in_buf (lead + page_cnt, base, bm_size);
+  bitmap_set_multiple (zone.used_map, 0, lead, true);
+  zone.order_map = (uint8_t *) base + bm_size;
+  memset (zone.order_map, ORDER_NONE, lead + page_cnt);
+  zone.owner_map = zone.order_map + max_cnt;
+  zone.base = first - lead * PGSIZE;
+  zone.page_cnt = lead + page_cnt;
+  zone.first_idx = lead;
+  zone.free_pages = 0;
+  zone.zeroed_cnt = zone.dirty_cnt = 0;
+  zone.zero_hits = zone.zero_misses = 0;
+  for (order = 0; order < ORDERS; order++)
+    {
+      list_init (&zone.free[order]);
+      zone.free_cnt[order] = 0;
+    }
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  /* Hand the whole zone to the buddy system. */
+  buddy_free (lead, page_cnt);
+  return page_cnt;
 }
 
-/* Returns true if PAGE was allocated from POOL,
-   false otherwise. */
-static bool
-page_from_pool (const struct pool *pool, void *page) 
+/* Returns the pool that allocated block PAGE is charged to. */
+static struct pool *
+page_owner (void *page)
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (zone.base) + zone.first_idx;
+  size_t end_page = pg_no (zone.base) + zone.page_cnt;
+
+  ASSERT (page_no >= start_page && page_no < end_page);
+  return &pools[zone.owner_map[page_no - pg_no (zone.base)]];
+}
+
+/* Returns the number of pages POOL may take: it must stay within
+   its high watermark, and unless it is still below its low
+   watermark it must leave enough free pages for the other pool
+   to reach its own.  Pages in the zeroed reserve count as free.
+   Interrupts must be off. */
+static size_t
+pool_headroom (const struct pool *pool)
+{
+  const struct pool *other = &pools[pool == &pools[USER_POOL]
+                                    ? KERNEL_POOL : USER_POOL];
+  size_t free_cnt = zone.free_pages + zone.zeroed_cnt + zone.dirty_cnt;
+  size_t owed = other->used < other->low ? other->low - other->used : 0;
+  size_t room = free_cnt > owed ? free_cnt - owed : 0;
+  size_t to_low = pool->used < pool->low ? pool->low - pool->used : 0;
+  size_t to_high = pool->used < pool->high ? pool->high - pool->used : 0;
+
+  if (room < to_low)
+    room = to_low;
+  return room < to_high ? room : to_high;
+}
+
+/* Returns true if POOL may take PAGE_CNT more pages.
+   Interrupts must be off. */
+static bool
+pool_may_take (const struct pool *pool, size_t page_cnt)
+{
+  return page_cnt <= pool_headroom (pool);
+}
+
+/* Returns the number of pages that the pool selected by FLAGS
+   could hand out right now, ignoring fragmentation. */
+size_t
+palloc_available (enum palloc_flags flags)
+{
+  enum intr_level old_level = intr_disable ();
+  size_t room = pool_headroom (&pools[flags & PAL_USER
+                                      ? USER_POOL : KERNEL_POOL]);
+  intr_set_level (old_level);
+  return room;
+}
 
-  return page_no >= start_page && page_no < end_page;
+/* Calls the registered reclaim functions on behalf of a request
+   for PAGE_CNT pages with the given FLAGS.  Returns true if any
+   of them gave back memory. */
+static bool
+run_reclaimers (enum palloc_flags flags, size_t page_cnt)
+{
+  size_t freed = 0;
+  size_t i;
+
+  if (intr_context ())
+    return false;
+  for (i = 0; i < reclaimer_cnt; i++)
+    freed += reclaimers[i] (flags, page_cnt);
+  return freed > 0;
+}
+
+/* Takes PAGE_CNT contiguous pages from the buddy system and
+   returns the first, or a null pointer if none are available.
+   Interrupts must be off. */
+static void *
+take_pages (size_t page_cnt)
+{
+  size_t page_idx = buddy_alloc (page_cnt);
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
+
+  ASSERT (bitmap_none (zone.used_map, page_idx, page_cnt));
+  bitmap_set_multiple (zone.used_map, page_idx, page_cnt, true);
+  return zone.base + PGSIZE * page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGES to the buddy
+   system.  Interrupts must be off. */
+static void
+give_pages (void *pages, size_t page_cnt)
+{
+  size_t page_idx = pg_no (pages) - pg_no (zone.base);
+
+  ASSERT (bitmap_all (zone.used_map, page_idx, page_cnt));
+  bitmap_set_multiple (zone.used_map, page_idx, page_cnt, false);
+  buddy_free (page_idx, page_cnt);
+}
+
+/* Returns every page in the zeroed and dirty lists to the buddy
+   system.  Returns true if there were any.  Interrupts must be
+   off. */
+static bool
+reclaim_reserve (void)
+{
+  bool any = zone.zeroed_cnt > 0 || zone.dirty_cnt > 0;
+
+  while (zone.zeroed_cnt > 0)
+    give_pages (zone.zeroed[--zone.zeroed_cnt], 1);
+  while (zone.dirty_cnt > 0)
+    give_pages (zone.dirty[--zone.dirty_cnt], 1);
+  return any;
+}
+
+/* Fills the zeroed list up to ZERO_MAX pages, preferring pages
+   on the dirty list over fresh ones from the buddy system.
+   Zeroing happens with interrupts on. */
+static void
+fill_reserve (void)
+{
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      void *page;
+
+      if (zone.zeroed_cnt >= ZERO_MAX)
+        page = NULL;
+      else if (zone.dirty_cnt > 0)
+        page = zone.dirty[--zone.dirty_cnt];
+      else
+        page = take_pages (1);
+      if (page == NULL)
+        {
+          /* Dirty pages that will not fit go back to the buddy
+             system. */
+          while (zone.dirty_cnt > 0)
+            give_pages (zone.dirty[--zone.dirty_cnt], 1);
+          intr_set_level (old_level);
+          return;
+        }
+      intr_set_level (old_level);
+
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      if (zone.zeroed_cnt < ZERO_MAX)
+        zone.zeroed[zone.zeroed_cnt++] = page;
+      else
+        give_pages (page, 1);
+      intr_set_level (old_level);
+    }
+}
+
+/* Thread function that keeps the pre-zeroed reserve filled. */
+static void
+page_zeroer (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&zero_low);
+      fill_reserve ();
+    }
+}
+
+/* Returns the list element stored in page PAGE_IDX of the
+   zone. */
+static struct list_elem *
+idx_to_elem (size_t page_idx)
+{
+  return (struct list_elem *) (zone.base + PGSIZE * page_idx);
+}
+
+/* Returns the index within the zone of the page holding E. */
+static size_t
+elem_to_idx (struct list_elem *e)
+{
+  return pg_no (e) - pg_no (zone.base);
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX on the free list
+   for ORDER, without trying to merge it. */
+static void
+push_block (size_t page_idx, int order)
+{
+  zone.order_map[page_idx] = order;
+  zone.free_cnt[order]++;
+  zone.free_pages += (size_t) 1 << order;
+  list_push_front (&zone.free[order], idx_to_elem (page_idx));
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off its
+   free list. */
+static void
+remove_block (size_t page_idx, int order)
+{
+  ASSERT (zone.order_map[page_idx] == order);
+  zone.order_map[page_idx] = ORDER_NONE;
+  zone.free_cnt[order]--;
+  zone.free_pages -= (size_t) 1 << order;
+  list_remove (idx_to_elem (page_idx));
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX, merging it with
+   its buddy as long as the buddy is free too. */
+static void
+free_block (size_t page_idx, int order)
+{
+  ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+  while (order < ORDERS - 1)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= zone.page_cnt || zone.order_map[buddy] != order)
+        break;
+      remove_block (buddy, order);
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+  push_block (page_idx, order);
+}
+
+/* Returns PAGE_CNT pages starting at PAGE_IDX to the zone, as the
+   largest aligned blocks that tile the range. */
+static void
+buddy_free (size_t page_idx, size_t page_cnt)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (page_cnt > 0)
+    {
+      int order = 0;
+      while (order < ORDERS - 1
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes PAGE_CNT contiguous pages from the zone and returns the
+   index of the first, or BITMAP_ERROR if no block is large
+   enough. */
+static size_t
+buddy_alloc (size_t page_cnt)
+{
+  size_t page_idx;
+  int order, want;
+
+  /* Find the smallest order that holds PAGE_CNT pages, then the
+     smallest nonempty free list at or above it. */
+  for (want = 0; want < ORDERS && ((size_t) 1 << want) < page_cnt; want++)
+    continue;
+  for (order = want; order < ORDERS; order++)
+    if (!list_empty (&zone.free[order]))
+      break;
+  if (order >= ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = elem_to_idx (list_front (&zone.free[order]));
+  remove_block (page_idx, order);
+
+  /* Split off the upper halves until the block is the right
+     size, then give back the pages past PAGE_CNT. */
+  while (order > want)
+    {
+      order--;
+      push_block (page_idx + ((size_t) 1 << order), order);
+    }
+  buddy_free (page_idx + page_cnt, ((size_t) 1 << want) - page_cnt);
+  return page_idx;
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  int order, i;
+
+  printf ("Palloc:");
+  for (order = 0; order < ORDERS; order++)
+    printf (" %zu", zone.free_cnt[order]);
+  printf (" free blocks by order, %zu of %zu pages free\n",
+          zone.free_pages, zone.page_cnt - zone.first_idx);
+  printf ("Palloc: %llu of %llu zeroed pages from reserve\n",
+          zone.zero_hits, zone.zero_hits + zone.zero_misses);
+  for (i = 0; i < 2; i++)
+    {
+      const struct pool *pool = &pools[i];
+      printf ("Palloc %s: %zu pages in use (peak %zu), "
+              "watermarks %zu-%zu, %llu reclaims, %llu failures\n",
+              pool->name, pool->used, pool->peak, pool->low, pool->high,
+              pool->reclaims, pool->failures);
+    }
 }
@@ -11,10 +11,18 @@ enum palloc_flags
     PAL_USER = 004              /* User page. */
   };
 
+/* Gives back memory to satisfy a request for PAGE_CNT pages with
+   the given flags.  Returns the number of pages freed. */
+typedef size_t palloc_reclaim_func (enum palloc_flags, size_t page_cnt);
+
 void palloc_init (size_t user_page_limit);
+void palloc_start_zeroer (void);
+void palloc_add_reclaim (palloc_reclaim_func *);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_available (enum palloc_flags);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
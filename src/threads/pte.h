@@ -66,6 +66,8 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, survives CR3 reloads (PTEs only). */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -80,6 +82,21 @@ static inline uint32_t *pde_get_pt (uint32_t pde) {
   return ptov (pde & PTE_ADDR);
 }
 
+/* Returns a PDE that maps the 4 MB "large page" at PAGE, which
+   must be aligned on a 4 MB boundary, directly, without a page
+   table.  The page is readable, writable if WRITABLE is true,
+   and usable only by the kernel.  Large pages require CR4_PSE. */
+static inline uint32_t pde_create_large (void *page, bool writable) {
+  ASSERT (vtop (page) % PTSPAN == 0);
+  return vtop (page) | PTE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
+/* Returns a pointer to the 4 MB page that large-page PDE maps. */
+static inline void *pde_get_large_page (uint32_t pde) {
+  ASSERT ((pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS));
+  return ptov (pde & ~(uint32_t) (PTSPAN - 1));
+}
+
 /* Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
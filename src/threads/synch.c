@@ -29,9 +29,66 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Lock contention statistics ("lockstat").
+
+   With -lockstat, every lock and semaphore is tied, when it is
+   initialized, to a `struct lockstat' for its initialization
+   call site, so that all the inodes' locks, for example, are
+   counted together.  We record acquisitions, how many of them
+   had to wait, how long they waited and (for locks) how long
+   the lock was then held, and the busiest call sites that
+   acquired it.  Times are in CPU timestamp counter cycles.
+   lockstat_print_stats() prints the classes sorted by total wait
+   time at shutdown.
+
+   Without -lockstat, the `stat' member of each semaphore is null
+   and the only cost is testing it. */
+bool lockstat_enabled;
+
+/* Statistics for one acquiring call site. */
+struct lockstat_site
+  {
+    void *eip;                  /* Caller of lock_acquire() etc. */
+    uint64_t acquisitions;      /* Times acquired from here. */
+    uint64_t contended;         /* ...of which had to wait. */
+    uint64_t wait;              /* Total cycles waited. */
+  };
+
+#define LOCKSTAT_SITES 4        /* Acquiring sites kept per class. */
+#define LOCKSTAT_CLASSES 64     /* Maximum number of classes. */
+
+/* Statistics for the locks or semaphores initialized at one call
+   site. */
+struct lockstat
+  {
+    void *init_site;            /* Caller of lock_init() or sema_init(). */
+    bool is_lock;               /* Lock or plain semaphore? */
+    uint64_t acquisitions;      /* Number of acquisitions ("downs"). */
+    uint64_t contended;         /* ...of which had to wait. */
+    uint64_t wait_total;        /* Total cycles waited. */
+    uint64_t wait_max;          /* Longest single wait. */
+    uint64_t hold_total;        /* Total cycles held (locks only). */
+    uint64_t hold_max;          /* Longest single hold (locks only). */
+    struct lockstat_site sites[LOCKSTAT_SITES]; /* Acquiring sites. */
+    uint64_t other_sites;       /* Acquisitions from other sites. */
+  };
+
+static struct lockstat lockstats[LOCKSTAT_CLASSES];
+static size_t lockstat_cnt;
+
+/* Class for initialization sites beyond LOCKSTAT_CLASSES. */
+static struct lockstat lockstat_overflow;
+
+static void sema_init_plain (struct semaphore *, unsigned value);
+static void sema_down_from (struct semaphore *, void *site);
+static struct lockstat *lockstat_class (void *init_site, bool is_lock);
+static void lockstat_acquired (struct lockstat *, void *site,
+                               bool contended, uint64_t wait);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -43,11 +100,22 @@
      thread, if any). */
 void
 sema_init (struct semaphore *sema, unsigned value) 
+{
+  sema_init_plain (sema, value);
+  if (lockstat_enabled)
+    sema->stat = lockstat_class (__builtin_return_address (0), false);
+}
+
+/* Initializes SEMA to VALUE without tying it to a lockstat
+   class. */
+static void
+sema_init_plain (struct semaphore *sema, unsigned value) 
 {
   ASSERT (sema != NULL);
 
   sema->value = value;
   list_init (&sema->waiters);
+  sema->stat = NULL;
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -59,12 +127,25 @@ sema_init (struct semaphore *sema, unsigned value)
    thread will probably turn interrupts back on. */
 void
 sema_down (struct semaphore *sema) 
+{
+  sema_down_from (sema, __builtin_return_address (0));
+}
+
+/* Does the work of sema_down() on behalf of a caller at SITE,
+   which is charged for the wait if lockstat is enabled. */
+static void
+sema_down_from (struct semaphore *sema, void *site) 
 {
   enum intr_level old_level;
+  uint64_t start = 0;
+  bool contended;
 
   ASSERT (sema != NULL);
   ASSERT (!intr_context ());
   old_level = intr_disable ();
+  contended = sema->value == 0;
+  if (sema->stat != NULL && contended)
+    start = rdtsc ();
   while (sema->value == 0) 
     {
       //list_push_back (&sema->waiters, &thread_current ()->elem);
@@ -79,6 +160,9 @@ sema_down (struct semaphore *sema)
       thread_block ();
     }
   sema->value--;
+  if (sema->stat != NULL)
+    lockstat_acquired (sema->stat, site, contended,
+                       contended ? rdtsc () - start : 0);
   intr_set_level (old_level);
 }
 
@@ -100,6 +184,9 @@ sema_try_down (struct semaphore *sema)
     {
       sema->value--;
       success = true; 
+      if (sema->stat != NULL)
+        lockstat_acquired (sema->stat, __builtin_return_address (0),
+                           false, 0);
     }
   else
     success = false;
@@ -204,7 +291,10 @@ lock_init (struct lock *lock)
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  sema_init (&lock->semaphore, 1);
+  sema_init_plain (&lock->semaphore, 1);
+  if (lockstat_enabled)
+    lock->semaphore.stat = lockstat_class (__builtin_return_address (0),
+                                           true);
 }
 
 /*added*/
@@ -247,8 +337,10 @@ lock_acquire (struct lock *lock)
     }
   }
 
-  sema_down (&lock->semaphore);
+  sema_down_from (&lock->semaphore, __builtin_return_address (0));
   lock->holder = thread_current ();
+  if (lock->semaphore.stat != NULL)
+    lock->acquired = rdtsc ();
   /*added*/ 
   thread_current ()->waitingLock = NULL; //no longer waiting on lock 
 
@@ -270,8 +362,12 @@ lock_try_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
 
   success = sema_try_down (&lock->semaphore);
-  if (success)
-    lock->holder = thread_current ();
+  if (success) 
+    {
+      lock->holder = thread_current ();
+      if (lock->semaphore.stat != NULL)
+        lock->acquired = rdtsc ();
+    }
   return success;
 }
 
@@ -309,6 +405,17 @@ lock_release (struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
 
 
+  if (lock->semaphore.stat != NULL) 
+    {
+      struct lockstat *ls = lock->semaphore.stat;
+      enum intr_level old_level = intr_disable ();
+      uint64_t held = rdtsc () - lock->acquired;
+      ls->hold_total += held;
+      if (held > ls->hold_max)
+        ls->hold_max = held;
+      intr_set_level (old_level);
+    }
+
   /*added*/
   if(lock->holder->numDonations > 0)
    lock_release_donation(lock);
@@ -432,3 +539,142 @@ priority_greater_cond (const struct list_elem *a_, const struct list_elem *b_,
   
   return (a->semaphore.max->priority > b->semaphore.max->priority);
 }
+
+/* Returns the lockstat class for locks (if IS_LOCK) or
+   semaphores initialized at INIT_SITE, creating it if
+   necessary. */
+static struct lockstat *
+lockstat_class (void *init_site, bool is_lock) 
+{
+  struct lockstat *ls = NULL;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < lockstat_cnt; i++)
+    if (lockstats[i].init_site == init_site)
+      {
+        ls = &lockstats[i];
+        break;
+      }
+  if (ls == NULL) 
+    {
+      if (lockstat_cnt < LOCKSTAT_CLASSES) 
+        {
+          ls = &lockstats[lockstat_cnt++];
+          ls->init_site = init_site;
+          ls->is_lock = is_lock;
+        }
+      else
+        ls = &lockstat_overflow;
+    }
+  intr_set_level (old_level);
+  return ls;
+}
+
+/* Records an acquisition of a lock or semaphore in class LS by
+   the caller at SITE, which waited WAIT cycles if CONTENDED.
+   Interrupts must be off. */
+static void
+lockstat_acquired (struct lockstat *ls, void *site, bool contended,
+                   uint64_t wait) 
+{
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  ls->acquisitions++;
+  if (contended) 
+    {
+      ls->contended++;
+      ls->wait_total += wait;
+      if (wait > ls->wait_max)
+        ls->wait_max = wait;
+    }
+
+  for (i = 0; i < LOCKSTAT_SITES; i++)
+    if (ls->sites[i].eip == site || ls->sites[i].eip == NULL)
+      {
+        struct lockstat_site *s = &ls->sites[i];
+        s->eip = site;
+        s->acquisitions++;
+        if (contended) 
+          {
+            s->contended++;
+            s->wait += wait;
+          }
+        return;
+      }
+  ls->other_sites++;
+}
+
+/* Prints a line for lockstat class LS. */
+static void
+lockstat_print (const struct lockstat *ls, const char *kind) 
+{
+  size_t i;
+
+  printf ("%s %p: %llu acquired, %llu contended, "
+          "wait %llu total %llu max",
+          kind, ls->init_site, ls->acquisitions, ls->contended,
+          ls->wait_total, ls->wait_max);
+  if (ls->is_lock)
+    printf (", hold %llu total %llu max", ls->hold_total, ls->hold_max);
+  printf ("\n");
+
+  for (i = 0; i < LOCKSTAT_SITES && ls->sites[i].eip != NULL; i++)
+    printf ("  from %p: %llu acquired, %llu contended, %llu wait\n",
+            ls->sites[i].eip, ls->sites[i].acquisitions,
+            ls->sites[i].contended, ls->sites[i].wait);
+  if (ls->other_sites > 0)
+    printf ("  from other sites: %llu acquired\n", ls->other_sites);
+}
+
+/* Prints lock contention statistics, busiest classes first, if
+   -lockstat was given.  Classes are named by the address of
+   their initialization call site; use the `backtrace' utility
+   to translate addresses to source lines. */
+void
+lockstat_print_stats (void) 
+{
+  static struct lockstat snapshot[LOCKSTAT_CLASSES];
+  static struct lockstat *sorted[LOCKSTAT_CLASSES];
+  struct lockstat overflow;
+  enum intr_level old_level;
+  size_t cnt, i, j;
+
+  if (!lockstat_enabled)
+    return;
+
+  /* Take a snapshot, since printf() itself takes the console
+     lock. */
+  old_level = intr_disable ();
+  cnt = lockstat_cnt;
+  memcpy (snapshot, lockstats, cnt * sizeof *snapshot);
+  overflow = lockstat_overflow;
+  intr_set_level (old_level);
+
+  /* Insertion sort by descending total wait, then by
+     acquisitions. */
+  for (i = 0; i < cnt; i++) 
+    {
+      struct lockstat *ls = &snapshot[i];
+      for (j = i; j > 0; j--) 
+        {
+          struct lockstat *prev = sorted[j - 1];
+          if (prev->wait_total > ls->wait_total
+              || (prev->wait_total == ls->wait_total
+                  && prev->acquisitions >= ls->acquisitions))
+            break;
+          sorted[j] = prev;
+        }
+      sorted[j] = ls;
+    }
+
+  printf ("Lockstat: %zu classes (times in cycles)\n", cnt);
+  for (i = 0; i < cnt; i++)
+    if (sorted[i]->acquisitions > 0)
+      lockstat_print (sorted[i], sorted[i]->is_lock ? "Lock" : "Sema");
+  if (overflow.acquisitions > 0)
+    lockstat_print (&overflow, "Other");
+}
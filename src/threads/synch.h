@@ -10,6 +10,13 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* If true, gather lock contention statistics (see synch.c).
+   Controlled by kernel command-line option "-lockstat". */
+extern bool lockstat_enabled;
+
+struct lockstat;
 
 
 
@@ -19,6 +26,7 @@ struct semaphore
     unsigned value;             /* Current value. */
     struct list waiters;        /* List of waiting threads. */
     struct thread * max; 
+    struct lockstat *stat;      /* Contention statistics, or null. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -26,6 +34,7 @@ void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
+void lockstat_print_stats (void);
 
 /* Lock. */
 struct lock 
@@ -33,6 +42,7 @@ struct lock
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
     struct list_elem elem; 
+    uint64_t acquired;          /* TSC at acquisition, for lockstat. */
   };
 
 void lock_init (struct lock *);
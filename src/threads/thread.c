@@ -4,7 +4,9 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/cpu.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
@@ -28,8 +30,14 @@
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-//list of all the dying processes
-static struct list zombie_list;
+/* Registry of all threads, hashed by tid, for lookup_thread().
+   Tids are handed out sequentially, so taking the tid modulo the
+   bucket count spreads them evenly.  Threads are added when they
+   are created and removed when they exit; the exit status of a
+   dead process outlives its thread in userprog/process.c's
+   progress registry. */
+#define TID_BUCKET_CNT 64
+static struct list tid_buckets[TID_BUCKET_CNT];
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -40,6 +48,22 @@ static struct thread *initial_thread;
 /* Lock used by allocate_tid(). */
 static struct lock tid_lock;
 
+/* Cache of recycled thread pages.  Pages of dead threads are
+   pushed here by thread_schedule_tail() instead of going back to
+   the page allocator, and thread_create() pops them, so that
+   short-lived threads never touch palloc.  Only the `struct
+   thread' header of a recycled page is cleared (by
+   init_thread()); the stack part is left as it was.  Accessed
+   only with interrupts off, since thread_schedule_tail() cannot
+   sleep on a lock. */
+#define THREAD_CACHE_MAX 16     /* Maximum number of cached pages. */
+#define THREAD_CACHE_LOW 4      /* Refill when fewer than this. */
+static void *thread_cache[THREAD_CACHE_MAX];
+static size_t thread_cache_cnt;
+
+/* Upped to wake thread_cache_refill() when the cache runs low. */
+static struct semaphore thread_cache_low;
+
 /*lock and condition for sleepers*/
 
 
@@ -56,6 +80,13 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Scheduler statistics of threads that have exited, so that
+   thread_print_stats() can account for them too. */
+static struct schedstat exited_stats;
+
+/* Most threads thread_print_stats() lists individually. */
+#define STATS_THREAD_MAX 32
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
@@ -68,6 +99,9 @@ bool thread_mlfqs;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static void thread_cache_refill (void *aux UNUSED);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
@@ -75,6 +109,11 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static struct list *tid_bucket (tid_t);
+static void mark_ready (struct thread *);
+static void account_switch (struct thread *cur, struct thread *next);
+static void merge_stats (struct schedstat *, const struct schedstat *);
+static void print_histogram (const char *, const uint32_t *);
 
 
 void go_to_sleep(int64_t ticks){
@@ -102,20 +141,26 @@ void go_to_sleep(int64_t ticks){
 void
 thread_init (void) 
 {
+  size_t i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
+  sema_init (&thread_cache_low, 0);
   list_init (&ready_list);
   list_init (&sleep_list); /*added*/
-  list_init (&zombie_list); //added 
   list_init (&all_list);
+  for (i = 0; i < TID_BUCKET_CNT; i++)
+    list_init (&tid_buckets[i]);
 
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
+  initial_thread->run_since = rdtsc ();
   initial_thread->tid = allocate_tid ();
+  list_push_back (tid_bucket (initial_thread->tid), &initial_thread->tidelem);
   initial_thread->pwd = NULL;
 }
 
@@ -137,6 +182,11 @@ thread_start (void)
 
   /* Wait for the idle thread to initialize idle_thread. */
   sema_down (&idle_started);
+
+  /* Start the thread page cache refiller.  It runs at the lowest
+     priority, so it only fills the cache when nothing else
+     wants the CPU. */
+  thread_create ("thread-cache", PRI_MIN, thread_cache_refill, NULL);
 }
 
 /* Called by the timer interrupt handler at each timer tick.
@@ -168,6 +218,7 @@ thread_tick (void)
         thr->sleep_ticks = thr->sleep_ticks - 1; //decrement num. of ticks
 	if(thr->sleep_ticks ==0){ //time to wake up  
           list_remove(waitThread); //take off waiting list
+          mark_ready (thr);
           list_insert_ordered(&ready_list, &thr->elem, (list_less_func *) &priority_greater, NULL);
 
           
@@ -182,12 +233,72 @@ thread_tick (void)
     intr_yield_on_return ();
 }
 
-/* Prints thread statistics. */
+/* Prints thread statistics: the global tick counts, then the
+   scheduler statistics of each live thread, then the latency
+   histogram over all threads, live or dead. */
 void
 thread_print_stats (void) 
 {
+  static struct schedstat stats[STATS_THREAD_MAX];
+  static char names[STATS_THREAD_MAX][16];
+  static tid_t tids[STATS_THREAD_MAX];
+  struct schedstat total;
+  enum intr_level old_level;
+  struct list_elem *e;
+  size_t cnt = 0, skipped = 0;
+  size_t i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+
+  /* Take a snapshot, since printf() may sleep on the console
+     lock. */
+  old_level = intr_disable ();
+  total = exited_stats;
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      merge_stats (&total, &t->stats);
+      if (cnt < STATS_THREAD_MAX) 
+        {
+          stats[cnt] = t->stats;
+          strlcpy (names[cnt], t->name, sizeof names[cnt]);
+          tids[cnt] = t->tid;
+          cnt++;
+        }
+      else
+        skipped++;
+    }
+  intr_set_level (old_level);
+
+  for (i = 0; i < cnt; i++)
+    printf ("Thread %s (tid %d): %llu cycles run, %u dispatches, "
+            "%u voluntary, %u involuntary, %llu max latency\n",
+            names[i], tids[i], stats[i].run_cycles, stats[i].dispatches,
+            stats[i].voluntary, stats[i].involuntary,
+            stats[i].max_latency);
+  if (skipped > 0)
+    printf ("Thread: %zu more threads not shown\n", skipped);
+  print_histogram ("ready-to-run latency", total.latency);
+  print_histogram ("run length", total.runs);
+}
+
+/* Copies the scheduler statistics of the thread with the given
+   TID, or of the running thread if TID is 0, into *STATS.
+   Returns false if there is no such thread. */
+bool
+thread_get_stats (tid_t tid, struct schedstat *stats) 
+{
+  struct thread *t;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  t = tid == 0 ? thread_current () : lookup_thread (tid);
+  if (t != NULL)
+    *stats = t->stats;
+  intr_set_level (old_level);
+  return t != NULL;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -219,7 +330,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -233,6 +344,9 @@ thread_create (const char *name, int priority,
      member cannot be observed. */
   old_level = intr_disable ();
 
+  /* Make T visible to lookup_thread(). */
+  list_push_back (tid_bucket (tid), &t->tidelem);
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -300,6 +414,7 @@ thread_unblock (struct thread *t)
   list_insert_ordered(&ready_list, &t->elem, (list_less_func *) &priority_greater, NULL);
 
   t->status = THREAD_READY;
+  mark_ready (t);
 
   if((thread_current()->priority < t->priority) && (thread_current() != idle_thread)){
     if(intr_context ())
@@ -360,6 +475,7 @@ thread_exit (void)
 	process_exit();
   syscall_exit(); 
 #endif
+  fpu_exit (t);
 
 
 
@@ -367,7 +483,9 @@ thread_exit (void)
 and schedule another process. That process will destroy us
 when it calls thread_schedule_tail(). */
   intr_disable ();
+  merge_stats (&exited_stats, &thread_current ()->stats);
   list_remove (&thread_current()->allelem);
+  list_remove (&thread_current()->tidelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -390,6 +508,7 @@ thread_yield (void)
     //list_push_back (&ready_list, &cur->elem);
   list_sort(&ready_list, (list_less_func *) &priority_greater, NULL);
   cur->status = THREAD_READY;
+  mark_ready (cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -519,6 +638,79 @@ idle (void *idle_started_ UNUSED)
     }
 }
 
+/* Thread page cache refiller.  Blocks until alloc_thread_page()
+   reports that the cache is running low, then tops it up to half
+   its capacity with fresh pages from the kernel pool. */
+static void
+thread_cache_refill (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      sema_down (&thread_cache_low);
+      for (;;) 
+        {
+          enum intr_level old_level;
+          void *page;
+
+          if (thread_cache_cnt >= THREAD_CACHE_MAX / 2)
+            break;
+          page = palloc_get_page (0);
+          if (page == NULL)
+            break;
+
+          old_level = intr_disable ();
+          if (thread_cache_cnt < THREAD_CACHE_MAX)
+            {
+              thread_cache[thread_cache_cnt++] = page;
+              page = NULL;
+            }
+          intr_set_level (old_level);
+
+          if (page != NULL)
+            palloc_free_page (page);
+        }
+    }
+}
+
+/* Returns a page for a new thread, taken from the thread page
+   cache if possible and from the kernel pool otherwise.  Returns
+   a null pointer if no page is available.  Only the `struct
+   thread' at the bottom of the page is meaningful; init_thread()
+   clears it. */
+static struct thread *
+alloc_thread_page (void) 
+{
+  enum intr_level old_level;
+  void *page = NULL;
+  bool low;
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt > 0)
+    page = thread_cache[--thread_cache_cnt];
+  low = thread_cache_cnt < THREAD_CACHE_LOW;
+  intr_set_level (old_level);
+
+  if (low)
+    sema_up (&thread_cache_low);
+  if (page == NULL)
+    page = palloc_get_page (0);
+  return page;
+}
+
+/* Retires the page of dead thread T, keeping it in the thread
+   page cache if there is room and returning it to the kernel
+   pool otherwise.  Called with interrupts off. */
+static void
+free_thread_page (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_cache_cnt < THREAD_CACHE_MAX)
+    thread_cache[thread_cache_cnt++] = t;
+  else
+    palloc_free_page (t);
+}
+
 /* Function used as the basis for a kernel thread. */
 static void
 kernel_thread (thread_func *function, void *aux) 
@@ -574,6 +766,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->progress = NULL; 
   list_init(&t->fds); 
   t->next_handle = 2; 
+  list_init(&t->mappings);
 
 
   t->magic = THREAD_MAGIC;
@@ -596,38 +789,30 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Returns the live thread with the given TID, or a null pointer
+   if there is none.  Takes time independent of the number of
+   threads, barring pathological tid patterns. */
 struct thread *
-lookup_thread (tid_t tid){
-	struct thread *result = NULL;
-	enum intr_level old_level;
-	old_level = intr_disable();
-	struct list_elem *e;
-	//first search the active list of threads for this tid
-	for (e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e))
-  	{
-		struct thread *t = list_entry (e, struct thread, allelem);
-		if(t->tid == tid)
-		{
-			result = t;
-			break;
-		}
-	}
-	if (result == NULL){
-	//if you still haven't found it then search the dying list
-		for (e = list_begin (&zombie_list); e != list_end (&zombie_list); e = list_next (e))
-  		{
-    			struct thread *t = list_entry (e, struct thread, allelem);
-    			if (t->tid == tid)
-    			{
-      				result = t;
-      				break;
-    			}
-  		}
-	}
-	
-	intr_set_level (old_level);
-	return result;
-}  
+lookup_thread (tid_t tid) 
+{
+  struct thread *result = NULL;
+  struct list *bucket = tid_bucket (tid);
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, tidelem);
+      if (t->tid == tid)
+        {
+          result = t;
+          break;
+        }
+    }
+  intr_set_level (old_level);
+  return result;
+}
 
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
@@ -675,6 +860,9 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Arrange to trap on FPU use unless CUR owns the FPU state. */
+  fpu_switch (cur);
+
   /* Activate the new address space. */
 #ifdef USERPROG
   process_activate ();
@@ -687,7 +875,7 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread_page (prev);
     }
 }
 
@@ -708,7 +896,10 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
-  if(cur!= next) prev = switch_threads(cur, next); 
+  if(cur!= next) {
+    account_switch (cur, next);
+    prev = switch_threads(cur, next); 
+  }
   thread_schedule_tail(prev);
 }
 
@@ -726,6 +917,98 @@ allocate_tid (void)
   return tid;
 }
 
+/* Returns the histogram bucket for an event lasting CYCLES. */
+static int
+stats_bucket (uint64_t cycles) 
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < SCHEDSTAT_BUCKETS - 1) 
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Records that T has just been put on the ready list. */
+static void
+mark_ready (struct thread *t) 
+{
+  t->ready_since = rdtsc ();
+}
+
+/* Charges CUR for the run that is ending and NEXT for the wait
+   that is ending, as the scheduler switches from CUR to NEXT.
+   Interrupts must be off. */
+static void
+account_switch (struct thread *cur, struct thread *next) 
+{
+  uint64_t now = rdtsc ();
+  uint64_t ran = now - cur->run_since;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  cur->stats.run_cycles += ran;
+  cur->stats.runs[stats_bucket (ran)]++;
+  if (cur->status == THREAD_READY)
+    cur->stats.involuntary++;
+  else
+    cur->stats.voluntary++;
+
+  /* The idle thread is never put on the ready list, so it has no
+     meaningful latency. */
+  if (next != idle_thread) 
+    {
+      uint64_t waited = now - next->ready_since;
+      next->stats.latency[stats_bucket (waited)]++;
+      if (waited > next->stats.max_latency)
+        next->stats.max_latency = waited;
+    }
+  next->stats.dispatches++;
+  next->run_since = now;
+}
+
+/* Adds the counts in FROM to those in TO. */
+static void
+merge_stats (struct schedstat *to, const struct schedstat *from) 
+{
+  int i;
+
+  to->run_cycles += from->run_cycles;
+  if (from->max_latency > to->max_latency)
+    to->max_latency = from->max_latency;
+  to->dispatches += from->dispatches;
+  to->voluntary += from->voluntary;
+  to->involuntary += from->involuntary;
+  for (i = 0; i < SCHEDSTAT_BUCKETS; i++) 
+    {
+      to->latency[i] += from->latency[i];
+      to->runs[i] += from->runs[i];
+    }
+}
+
+/* Prints the nonempty buckets of log2 histogram HIST, which is
+   titled NAME. */
+static void
+print_histogram (const char *name, const uint32_t *hist) 
+{
+  int i;
+
+  printf ("Thread: %s histogram (cycles):", name);
+  for (i = 0; i < SCHEDSTAT_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" [2^%d] %u", i, hist[i]);
+  printf ("\n");
+}
+
+/* Returns the tid registry bucket for TID. */
+static struct list *
+tid_bucket (tid_t tid) 
+{
+  return &tid_buckets[(unsigned) tid % TID_BUCKET_CNT];
+}
+
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
@@ -8,7 +8,9 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <schedstat.h>
 #include <stdint.h>
 #include "threads/synch.h"
 
@@ -111,9 +113,15 @@ struct thread
     uint8_t *stack;                     /* Saved stack pointer. */
     uint64_t priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct list_elem tidelem;           /* List element for tid registry. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+
+    /* Scheduler accounting, owned by thread.c. */
+    struct schedstat stats;             /* Totals and histograms. */
+    uint64_t ready_since;               /* TSC when last made ready. */
+    uint64_t run_since;                 /* TSC when last switched in. */
     
     /*Added*/
     int64_t sleep_ticks; /*Added. Number of ticks to sleep in timer_sleep()*/
@@ -127,17 +135,27 @@ struct thread
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 
+    /* Owned by vm/page.c. */
+    struct hash *pages;                 /* Supplemental page table. */
+    void *user_esp;                     /* User esp at last syscall or fault. */
+    struct fault_window *fault_windows; /* Fault-around state, or null. */
+
     //shared between userprog/process.c and thread.c
     struct file * file_to_run; //file to run (executable)
 
 
     struct list fds; //list of file descriptors 
     int next_handle; //next handle value (???)
+    struct list mappings; //memory-mapped files, owned by userprog/syscall.c
 
     struct progress *progress;  //this process's completion status
     struct list children; //list of children's progresses
 
     struct dir *pwd;
+
+    /* Owned by threads/fpu.c. */
+    void *fpu;                          /* FPU save area, null if unused. */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
    
@@ -151,6 +169,8 @@ struct thread
   struct progress 
   { 
     struct list_elem elem; //child list element 
+    struct hash_elem tid_elem; //element in process.c's progress registry
+    struct thread *parent; //parent, or NULL once the parent has let go
     struct lock lock; //protects reference count
     int ref; //0 = child and parent both dead, 1 = one of the two alive, 2 = both alive
     tid_t tid; //child thread id
@@ -168,6 +188,7 @@ void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+bool thread_get_stats (tid_t, struct schedstat *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -180,6 +201,7 @@ tid_t thread_tid (void);
 const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
+struct thread *lookup_thread (tid_t);
 void thread_yield (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
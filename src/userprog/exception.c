@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -45,8 +49,6 @@ exception_init (void)
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
-                     "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
   intr_register_int (13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -148,6 +150,26 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* A not-present page that belongs to the process has just not
+     been brought in yet, or is a new stack page.  This also
+     happens in the kernel, when a system call touches a user
+     buffer; then the user stack pointer was saved on entry to
+     the system call, since F->esp is the kernel's. */
+  if (user)
+    thread_current ()->user_esp = f->esp;
+  if (not_present && is_user_vaddr (fault_addr)
+      && page_in (fault_addr, write))
+    return;
+
+  /* A write to a present, read-only page may be a write to a page
+     shared copy-on-write with a forked process.  The kernel also
+     faults on such a page, because CR0.WP is set. */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && page_copy_on_write (fault_addr))
+    return;
+#endif
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -8,27 +8,84 @@
 #include <list.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"/
+#include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmd_line, void (**eip) (void), void **esp);
+static uint8_t *get_large_page (void);
+
+bool user_large_pages;
+
+/* Registry of every live `struct progress', hashed by tid, so
+   that process_wait() can find a child without walking its
+   children list.  An entry outlives the child's thread as a
+   zombie holding the exit status until its reference count
+   drops to zero. */
+static struct hash progress_table;
+static struct lock progress_lock;
+static struct kmem_cache *progress_cache;
+
+static hash_hash_func progress_hash;
+static hash_less_func progress_less;
 
 struct file_info { 
   const char * file_name; //name of file to be executed
   struct semaphore loaded; //keeps track of whether file is successfully loaded
   struct progress *p; //child process
   bool success; //true if program successfully loaded 
+  struct thread *parent; //for fork: process being copied
+  const struct intr_frame *fork_frame; //for fork: parent's user registers
 }; 
 
+static tid_t adopt_child (tid_t, struct file_info *);
+static bool init_progress (struct file_info *);
+
+
+/* Initializes the progress registry. */
+void
+process_init (void) 
+{
+  hash_init (&progress_table, progress_hash, progress_less, NULL);
+  lock_init (&progress_lock);
+  progress_cache = kmem_cache_create ("progress", sizeof (struct progress),
+                                      0, NULL);
+}
+
+/* Returns the hash value of progress P_. */
+static unsigned
+progress_hash (const struct hash_elem *p_, void *aux UNUSED) 
+{
+  const struct progress *p = hash_entry (p_, struct progress, tid_elem);
+  return hash_int (p->tid);
+}
+
+/* Returns true if progress A_ has a lower tid than B_. */
+static bool
+progress_less (const struct hash_elem *a_, const struct hash_elem *b_,
+               void *aux UNUSED) 
+{
+  const struct progress *a = hash_entry (a_, struct progress, tid_elem);
+  const struct progress *b = hash_entry (b_, struct progress, tid_elem);
+  return a->tid < b->tid;
+}
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -46,6 +103,8 @@ process_execute (const char *file_name)
   /*KG added. Initialize file info*/ 
   struct file_info file; 
   file.file_name = file_name; 
+  file.parent = NULL;
+  file.fork_frame = NULL;
   sema_init(&file.loaded, 0);
 
 
@@ -57,16 +116,51 @@ process_execute (const char *file_name)
 
   /* Create a new thread to execute fname. */
   tid = thread_create (fname, PRI_DEFAULT, start_process, &file);
+  return adopt_child (tid, &file);
+}
+
+/* Waits for the new child thread TID, started with INFO, to
+   finish setting itself up, and makes it a child of the current
+   process.  Returns TID, or TID_ERROR if the child could not be
+   created or failed to start. */
+static tid_t
+adopt_child (tid_t tid, struct file_info *info)
+{
   if(tid != TID_ERROR){
-    sema_down(&file.loaded); 
-    if(file.success)
-      list_push_back(&thread_current()->children, &file.p->elem); //add progress struct to list of current thread's children 
+    sema_down(&info->loaded); 
+    if(info->success){
+      info->p->parent = thread_current();
+      list_push_back(&thread_current()->children, &info->p->elem); //add progress struct to list of current thread's children 
+      lock_acquire(&progress_lock);
+      hash_insert(&progress_table, &info->p->tid_elem);
+      lock_release(&progress_lock);
+    }
     else
       tid = TID_ERROR; 
   }
   return tid;
 }
 
+/* Allocates and initializes the current thread's progress
+   struct, for its parent to find in INFO.  Returns true if
+   successful, false if memory allocation failed. */
+static bool
+init_progress (struct file_info *info)
+{
+  struct progress *p = kmem_cache_alloc(progress_cache);
+
+  info->p = thread_current()->progress = p;
+  if(p == NULL)
+    return false;
+  lock_init(&p->lock); 
+  p->ref = 2; //both alive
+  p->parent = NULL; //set by adopt_child()
+  p->tid = thread_current()->tid; 
+  p->exit_status = -1; 
+  sema_init(&p->dead, 0); 
+  return true;
+}
+
 /* A thread function that loads a user process and starts it
    running. */
 static void
@@ -86,17 +180,8 @@ start_process (void *file_name_)
   success = load (f->file_name, &if_.eip, &if_.esp);
 
   //KG added
-  if(success){
-    f->p = thread_current()-> progress = malloc(sizeof *f->p); 
-    success = f->p != NULL; 
-  }
-  if(success){
-    lock_init(&f->p->lock); 
-    f->p->ref = 2; //both alive
-    f->p->tid = thread_current()->tid; 
-    f->p->exit_status = -1; 
-    sema_init(&f->p->dead, 0); 
-  }
+  if(success)
+    success = init_progress(f);
   
 
 
@@ -125,14 +210,116 @@ start_process (void *file_name_)
   asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
   NOT_REACHED ();
 }
+#ifdef VM
+/* Gives the current process copies of the 4 MB large pages
+   mapped in page directory PARENT_PD.  They are read-only, but
+   pagedir_destroy() frees them with their page directory, so
+   each process needs its own.  Returns true if successful, false
+   if no large page is available. */
+static bool
+copy_large_pages (uint32_t *parent_pd)
+{
+  uint32_t *pde;
+
+  for (pde = parent_pd; pde < parent_pd + pd_no (PHYS_BASE); pde++)
+    if ((*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS))
+      {
+        void *upage = (void *) ((pde - parent_pd) << PDSHIFT);
+        uint8_t *kpage = get_large_page ();
+        if (kpage == NULL)
+          return false;
+        memcpy (kpage, pde_get_large_page (*pde), PTSPAN);
+        if (!pagedir_set_large_page (thread_current ()->pagedir, upage,
+                                     kpage, false))
+          {
+            palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+            return false;
+          }
+      }
+  return true;
+}
+
+/* A thread function that turns a new thread into a copy of the
+   process INFO_->parent, which is blocked in process_fork(), and
+   returns to user mode as if from its fork() system call. */
+static void
+fork_process (void *info_)
+{
+  struct file_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = info->parent;
+  struct intr_frame if_ = *info->fork_frame;
+  bool success = false;
+
+  /* fork() returns 0 in the child. */
+  if_.eax = 0;
+
+  /* Copy the FPU state, the address space, sharing pages
+     copy-on-write, then the open files.  The current directory
+     was already inherited by thread_create(). */
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir != NULL && page_table_create () && fpu_copy (parent))
+    {
+      process_activate ();
+      cur->file_to_run = file_reopen (parent->file_to_run);
+      if (cur->file_to_run != NULL)
+        {
+          file_deny_write (cur->file_to_run);
+          success = (page_table_fork (parent, parent->file_to_run,
+                                      cur->file_to_run)
+                     && copy_large_pages (parent->pagedir)
+                     && syscall_fork (parent));
+        }
+    }
+  if (success)
+    success = init_progress (info);
+
+  info->success = success;
+  sema_up (&info->loaded);
+  if (!success)
+    thread_exit ();
+
+  /* Start the user process, as in start_process(). */
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Creates a child process that is a copy of the current one,
+   which entered the kernel with the registers in IF_, and
+   returns its thread id, or TID_ERROR on failure.  The child's
+   fork() returns 0.  Memory is shared copy-on-write, so forking
+   costs a page table walk rather than a copy of every page.  The
+   child gets its own copies of the open file descriptors, at the
+   same positions, but no memory-mapped files. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct file_info info;
+  tid_t tid;
+
+  info.file_name = NULL;
+  info.parent = cur;
+  info.fork_frame = if_;
+  sema_init (&info.loaded, 0);
+
+  tid = thread_create (cur->name, PRI_DEFAULT, fork_process, &info);
+  return adopt_child (tid, &info);
+}
+#endif /* VM */
+
 static void remove_child(struct progress *p){
   int count; 
   lock_acquire(&p->lock); 
   count = --p -> ref;
   lock_release(&p->lock); 
 
-  if(count==0)
-    free(p);
+  if(count==0){
+    lock_acquire(&progress_lock);
+    hash_delete(&progress_table, &p->tid_elem);
+    lock_release(&progress_lock);
+    kmem_cache_free(progress_cache, p);
+  }
 }
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
@@ -147,21 +334,30 @@ int
 process_wait (tid_t child_tid) 
 {
   struct thread *t = thread_current(); 
-  struct list_elem *e, *next; 
+  struct progress key, *child = NULL;
+  struct hash_elem *e;
   int result; //to be returned (exit code)
-  for(e = list_begin(&t->children); e != list_end(&t->children); e = next)
-  {
-    struct progress *child = list_entry(e, struct progress, elem);
-    if(child->tid == child_tid)
-    {
-       sema_down(&child->dead);
-       result = child->exit_status;
-       next = list_remove(e);
-       remove_child(child);
-       return result;
-    }
+
+  /* Only a direct child that we have not yet waited for still
+     names us as its parent. */
+  key.tid = child_tid;
+  lock_acquire(&progress_lock);
+  e = hash_find(&progress_table, &key.tid_elem);
+  if(e != NULL){
+    child = hash_entry(e, struct progress, tid_elem);
+    if(child->parent != t)
+      child = NULL;
   }
-	return -1; 
+  lock_release(&progress_lock);
+  if(child == NULL)
+    return -1;
+
+  sema_down(&child->dead);
+  result = child->exit_status;
+  child->parent = NULL;
+  list_remove(&child->elem);
+  remove_child(child);
+  return result;
 }
 
 /* Free the current process's resources. */
@@ -173,7 +369,31 @@ process_exit (void)
   struct list_elem *e, *next; 
 
 
-  /*KG added. close executable*/
+  /* Destroy the current process's page directory and switch back
+     to the kernel-only page directory.  This comes before telling
+     the parent that we have exited, so that by the time its
+     wait() returns, the dirty pages of our memory-mapped files
+     have been written back. */
+  pd = cur->pagedir;
+  if (pd != NULL) 
+    {
+      /* Correct ordering here is crucial.  We must set
+         cur->pagedir to NULL before switching page directories,
+         so that a timer interrupt can't switch back to the
+         process page directory.  We must activate the base page
+         directory before destroying the process's page
+         directory, or our active page directory will be one
+         that's been freed (and cleared). */
+#ifdef VM
+      page_exit ();
+#endif
+      cur->pagedir = NULL;
+      pagedir_activate (NULL);
+      pagedir_destroy (pd);
+    }
+
+  /* Close the executable only now, after page_exit() has dropped
+     any frames that the text frame table knows by its inode. */
   file_close(cur->file_to_run);
 
   /*KG added. Notify parent*/ 
@@ -188,6 +408,7 @@ process_exit (void)
   for(e = list_begin(&cur->children); e!= list_end(&cur->children); e = next){
     struct progress *p = list_entry(e, struct progress, elem); 
     next = list_remove(e); 
+    p->parent = NULL;
     remove_child(p);
   }
 
@@ -195,23 +416,6 @@ process_exit (void)
   if(thread_current()->pwd){
     dir_close(thread_current()->pwd);
   }
-
-  /* Destroy the current process's page directory and switch back
-     to the kernel-only page directory. */
-  pd = cur->pagedir;
-  if (pd != NULL) 
-    {
-      /* Correct ordering here is crucial.  We must set
-         cur->pagedir to NULL before switching page directories,
-         so that a timer interrupt can't switch back to the
-         process page directory.  We must activate the base page
-         directory before destroying the process's page
-         directory, or our active page directory will be one
-         that's been freed (and cleared). */
-      cur->pagedir = NULL;
-      pagedir_activate (NULL);
-      pagedir_destroy (pd);
-    }
 }
 
 /* Sets up the CPU for running user code in the current
@@ -222,8 +426,16 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
   //printf("Activating process \n"); //added for debugging purposes 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+
+  /* Activate thread's page tables.  A thread without a page
+     directory never touches user memory and the kernel mappings
+     are the same in every page directory, so it just keeps
+     running on whichever one is loaded, leaving the TLB intact.
+     process_exit() switches to init_page_dir itself before
+     destroying a page directory, so the one we keep is never a
+     freed one. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -322,6 +534,10 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create (); 
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_create ())
+    goto done;
+#endif
   
   process_activate ();
   /*added*/
@@ -432,7 +648,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -479,6 +697,25 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
   return true;
 }
 
+/* Returns 1024 physically contiguous user pages aligned on a
+   4 MB boundary, suitable for a large page, or a null pointer if
+   the CPU lacks large pages or no such block is free. */
+static uint8_t *
+get_large_page (void) 
+{
+  uint8_t *kpage;
+
+  if (!(cpu_features () & CPUID_PSE))
+    return NULL;
+  kpage = palloc_get_multiple (PAL_USER, PTSPAN / PGSIZE);
+  if (kpage != NULL && vtop (kpage) % PTSPAN != 0) 
+    {
+      palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+      kpage = NULL;
+    }
+  return kpage;
+}
+
 /* Loads a segment starting at offset OFS in FILE at address
    UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
    memory are initialized, as follows:
@@ -490,6 +727,12 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
 
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
+   With "-largepages", aligned 4 MB stretches of a read-only
+   segment are loaded into large pages where possible.
+
+   With virtual memory, other pages are not read here at all.
+   Each one is recorded in the supplemental page table and read
+   in by page_in() when the process first touches it.
 
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
@@ -501,22 +744,68 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
+      /* Load a whole, aligned 4 MB of a read-only segment into a
+         large page, if enabled and one is available. */
+      if (user_large_pages && !writable
+          && (uintptr_t) upage % PTSPAN == 0
+          && read_bytes + zero_bytes >= PTSPAN) 
+        {
+          uint8_t *kpage = get_large_page ();
+          if (kpage != NULL) 
+            {
+              size_t large_read_bytes = (read_bytes < PTSPAN
+                                         ? read_bytes : PTSPAN);
+
+              if (file_read_at (file, kpage, large_read_bytes, ofs)
+                  != (int) large_read_bytes)
+                {
+                  palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+                  return false;
+                }
+              memset (kpage + large_read_bytes, 0, PTSPAN - large_read_bytes);
+              if (!pagedir_set_large_page (thread_current ()->pagedir,
+                                           upage, kpage, false))
+                {
+                  palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+                  return false;
+                }
+
+              read_bytes -= large_read_bytes;
+              zero_bytes -= PTSPAN - large_read_bytes;
+              ofs += large_read_bytes;
+              upage += PTSPAN;
+              continue;
+            }
+        }
+
       /* Calculate how to fill this page.
          We will read PAGE_READ_BYTES bytes from FILE
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where the page comes from. */
+      struct page *p = page_allocate (upage, !writable);
+      if (p == NULL)
+        return false;
+      if (page_read_bytes > 0)
+        {
+          p->file = file;
+          p->file_offset = ofs;
+          p->file_bytes = page_read_bytes;
+        }
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
         return false;
 
       /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
+      if (file_read_at (file, kpage, page_read_bytes, ofs)
+          != (int) page_read_bytes)
         {
           palloc_free_page (kpage);
           return false; 
@@ -529,10 +818,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
   return true;
@@ -612,6 +903,29 @@ static bool arg_init(uint8_t * kpage, uint8_t * upage, void **esp, const char *
 
 
 
+#ifdef VM
+/* Create a minimal stack by adding a zeroed page at the top of
+   user virtual memory to the supplemental page table, and push
+   the arguments onto it. */
+static bool
+setup_stack (void **esp, const char *cmd_line) 
+{
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  struct page *p = page_allocate (upage, false);
+  bool success;
+
+  if (p == NULL || !page_lock (upage, true))
+    return false;
+  success = arg_init (p->frame->base, upage, esp, cmd_line);
+
+  /* arg_init() wrote through the kernel's mapping of the frame,
+     which leaves the user page's dirty bit clear.  Set it, so
+     that eviction does not drop the arguments. */
+  pagedir_set_dirty (thread_current ()->pagedir, upage, true);
+  page_unlock (upage);
+  return success;
+}
+#else
 /* Create a minimal stack by mapping a zeroed page at the top of
    user virtual memory. */
 static bool
@@ -634,7 +948,9 @@ setup_stack (void **esp, const char *cmd_line)
     }
   return success_cmd_line;
 }
+#endif
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -654,3 +970,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
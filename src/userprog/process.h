@@ -3,7 +3,16 @@
 
 #include "threads/thread.h"
 
+struct intr_frame;
+
+/* If true, read-only segments that cover whole, aligned 4 MB
+   regions are loaded into 4 MB large pages.
+   Controlled by kernel command-line option "-largepages". */
+extern bool user_large_pages;
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_fork (const struct intr_frame *);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -14,10 +15,14 @@
 #include "userprog/exception.h"
 #include "userprog/pagedir.h"
 #include "devices/input.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 static void copy_in (void *, const void *, size_t);
 static struct lock file_sys_lock;//added
+static struct kmem_cache *fd_cache;
 static struct file_descriptor * find_fd(int handle); 
 static int sys_halt (void);
 static int sys_exit (int status);
@@ -37,8 +42,16 @@ static bool sys_mkdir (const char* dir);
 static bool sys_readdir (int fd, char* name);
 static bool sys_isdir (int fd);
 static int sys_inumber (int fd);
+static bool sys_schedstat (tid_t tid, struct schedstat *stats);
+#ifdef VM
+static int sys_mmap (int handle, void *addr);
+static int sys_munmap (int mapping);
+static int sys_fork (struct intr_frame *);
+#endif
 
 static bool verify_pointer(const void*);
+static bool pin_page(const void*, bool);
+static void unpin_page(const void*);
 
 struct file_descriptor{
 	struct list_elem elem; 
@@ -46,6 +59,16 @@ struct file_descriptor{
 	int handle; //file handle
   struct dir * directory;
 };
+
+/*A memory-mapped file.  Mapping ids are handed out from the same
+counter as file descriptors.*/
+struct mapping{
+  struct list_elem elem;
+  int handle; //mapping id
+  struct file *file; //file, reopened so it outlives close()
+  uint8_t *base; //start of memory mapping
+  size_t page_cnt; //number of pages mapped
+};
 /*
 void do_dis(struct file * file){
   lock_acquire(&file_sys_lock);
@@ -58,6 +81,8 @@ syscall_init (void)
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
   lock_init(&file_sys_lock); 
+  fd_cache = kmem_cache_create ("fd", sizeof (struct file_descriptor), 0,
+                                NULL);
 }
 
 static void
@@ -65,6 +90,9 @@ syscall_handler (struct intr_frame *f)
 {
   //dereference esp to get syscall number
   int *sys = (int*)(f->esp); 
+#ifdef VM
+  thread_current()->user_esp = f->esp; //for stack growth in page faults
+#endif
   if(!verify_pointer(sys))
 	sys_exit(-1);
   int args[3]; 
@@ -125,6 +153,20 @@ syscall_handler (struct intr_frame *f)
     case SYS_INUMBER:
       result = sys_inumber(args[0]);
       break;
+    case SYS_SCHEDSTAT:
+      result = sys_schedstat((tid_t)args[0], (struct schedstat *)args[1]);
+      break;
+#ifdef VM
+    case SYS_MMAP:
+      result = sys_mmap(args[0], (void *)args[1]);
+      break;
+    case SYS_MUNMAP:
+      result = sys_munmap(args[0]);
+      break;
+    case SYS_FORK:
+      result = sys_fork(f);
+      break;
+#endif
     default: 
       printf("Error in system call number %d. Exiting.", *sys); 
       sys_halt(); 
@@ -136,11 +178,44 @@ syscall_handler (struct intr_frame *f)
 /*verifies if user address requested is in 
 user space and is not mapped to NULL*/
 //Returns true if UADDR is a valid, mapped user address 
+//With virtual memory, a page that is not loaded yet is brought in
 static bool
 verify_pointer (const void *uaddr)
 {
-  return (uaddr < PHYS_BASE
-          && pagedir_get_page (thread_current ()->pagedir, uaddr) != NULL);
+  if (uaddr >= PHYS_BASE)
+    return false;
+  if (pagedir_get_page (thread_current ()->pagedir, uaddr) != NULL)
+    return true;
+#ifdef VM
+  return page_in ((void *) uaddr, false);
+#else
+  return false;
+#endif
+}
+
+/*Returns true if the user page containing UADDR is valid and
+mapped, and writable if WRITE is true.  With virtual memory, the
+page is also brought in and kept in memory until unpin_page(), so
+that the file system never takes a page fault on it.*/
+static bool
+pin_page (const void *uaddr, bool write)
+{
+#ifdef VM
+  return uaddr < PHYS_BASE && page_lock (uaddr, write);
+#else
+  return (verify_pointer (uaddr)
+          && (!write
+              || pagedir_is_writable (thread_current ()->pagedir, uaddr)));
+#endif
+}
+
+/*Releases a page pinned by pin_page().*/
+static void
+unpin_page (const void *uaddr UNUSED)
+{
+#ifdef VM
+  page_unlock (uaddr);
+#endif
 }
 
 
@@ -327,7 +402,7 @@ static int sys_open (const char *file){
 		char * kfile = copy_in_string(file); 
 		struct file_descriptor *fd; 
 		int handle = -1; 
-		fd = malloc(sizeof *fd); 
+		fd = kmem_cache_alloc(fd_cache); 
 		if(fd!=NULL){
 			lock_acquire (&file_sys_lock);
 			fd->file = filesys_open (kfile);
@@ -335,7 +410,7 @@ static int sys_open (const char *file){
 				struct thread *t = thread_current(); 
 				handle = fd->handle = t->next_handle++; 
 				list_push_front(&t->fds, &fd->elem); 
-			} else free(fd); 
+			} else kmem_cache_free(fd_cache, fd); 
 
 		lock_release (&file_sys_lock);
 	}
@@ -369,31 +444,54 @@ static int sys_filesize (int handle){
 actually read (0 at end of file), or -1 if the file could not be read (due to a condition
 other than end of file). fd 0 reads from the keyboard using input_getc().*/
 static int sys_read (int handle, void *buffer, unsigned length){
-  char* udst = (char*) buffer;
-  unsigned bytes_read = 0;
+  uint8_t *udst = buffer;
+  int bytes_read = 0;
   struct file_descriptor* fd = NULL;
 
   if (handle != STDIN_FILENO)
     fd = find_fd(handle);
 
   lock_acquire(&file_sys_lock);
-  if (!verify_pointer(buffer))
+  do
   {
-    lock_release(&file_sys_lock);
-    thread_exit();
-  }
-  if (handle == STDIN_FILENO)
-  {
-    for(bytes_read = 0; bytes_read < length; bytes_read++)
+    /* How many bytes to read into this page. */
+    size_t page_left = PGSIZE - pg_ofs (udst);
+    size_t read_amt = length < page_left ? length : page_left;
+    off_t retval;
+
+    /* Check that we can write this user page. */
+    if (!pin_page (udst, true))
+    {
+      lock_release(&file_sys_lock);
+      thread_exit();
+    }
+
+    /* Perform read. */
+    if (handle == STDIN_FILENO)
     {
-      *udst = (char) input_getc();
-      udst++;
+      for (retval = 0; retval < (off_t) read_amt; retval++)
+        udst[retval] = input_getc();
     }
+    else
+      retval = file_read(fd->file, udst, read_amt);
+    unpin_page (udst);
+    if (retval < 0)
+    {
+      if (bytes_read == 0)
+        bytes_read = -1;
+      break;
+    }
+    bytes_read += retval;
+
+    /* If it was a short read we're done. */
+    if (retval != (off_t) read_amt)
+      break;
+
+    /* Advance. */
+    udst += retval;
+    length -= retval;
   }
-  else
-  {
-    bytes_read = file_read(fd->file, buffer, length);
-  }
+  while (length > 0);
 
   lock_release(&file_sys_lock);
   return bytes_read;
@@ -435,7 +533,7 @@ static int sys_write (int handle, void *buffer, unsigned length){
     off_t retval;
 
     /* Check that we can touch this user page. */
-    if (!verify_pointer (buffer))
+    if (!pin_page (usrc, false))
     {
       lock_release (&file_sys_lock);
       thread_exit ();
@@ -449,6 +547,7 @@ static int sys_write (int handle, void *buffer, unsigned length){
     }
     else
       retval = file_write (fd->file, usrc, write_amt);
+    unpin_page (usrc);
     if (retval < 0)
     {
       if (bytes_written == 0)
@@ -500,11 +599,13 @@ static int sys_close (int handle){
   file_close(fd->file); //file_close also allows writes
   lock_release(&file_sys_lock);
   list_remove(&fd->elem);
-  free(fd);
+  kmem_cache_free(fd_cache, fd);
   return 0;
 }
 
-/* On thread exit, close all open files. */
+/* On thread exit, close all open files.  process_exit() has
+   already torn down the page table, writing mapped pages back, so
+   all that is left of each mapping is its file. */
 void
 syscall_exit (void)
 {
@@ -519,13 +620,59 @@ syscall_exit (void)
     struct file_descriptor* fd = list_entry(e, struct file_descriptor, elem);
     file_close(fd->file); //file_close also allows writes 
     next = list_remove(e);
-    free(fd);
+    kmem_cache_free(fd_cache, fd);
+  }
+
+  s = &cur->mappings;
+  for(e = list_begin(s); e != list_end(s); e = next)
+  {
+    struct mapping *m = list_entry(e, struct mapping, elem);
+    file_close(m->file);
+    next = list_remove(e);
+    free(m);
   }
 
   lock_release(&file_sys_lock);
   return;
 }
 
+/* Gives the current process, which is being forked from PARENT,
+   copies of PARENT's file descriptors, with the same handles and
+   file positions.  Returns true if successful, false if memory
+   allocation failed. */
+bool
+syscall_fork (struct thread *parent)
+{
+  struct thread *cur = thread_current();
+  struct list_elem *e;
+  bool success = true;
+
+  lock_acquire(&file_sys_lock);
+  for(e = list_begin(&parent->fds); e != list_end(&parent->fds);
+      e = list_next(e))
+  {
+    struct file_descriptor *pfd = list_entry(e, struct file_descriptor, elem);
+    struct file_descriptor *fd = kmem_cache_alloc(fd_cache);
+    if(fd == NULL){
+      success = false;
+      break;
+    }
+    fd->file = file_reopen(pfd->file);
+    if(fd->file == NULL){
+      kmem_cache_free(fd_cache, fd);
+      success = false;
+      break;
+    }
+    file_seek(fd->file, file_tell(pfd->file));
+    fd->handle = pfd->handle;
+    fd->directory = NULL;
+    list_push_back(&cur->fds, &fd->elem);
+  }
+  lock_release(&file_sys_lock);
+  cur->next_handle = parent->next_handle;
+  return success;
+}
+
 /*Changes the current working directory of the process to dir, 
 which may be relative or absolute. Returns TRUE if successful, 
 FALSE on failure.*/
@@ -609,3 +756,131 @@ static int sys_inumber (int handle){
   return inumber;
 }
 
+/*Copies the scheduler statistics of thread TID, or of the calling
+process if TID is 0, into STATS: run time, voluntary and involuntary
+switches, and log2 histograms of ready-to-running latency and run
+length. Returns false if there is no thread TID.*/
+static bool sys_schedstat (tid_t tid, struct schedstat *stats){
+  struct schedstat kstats;
+  uint8_t *udst = (uint8_t *) stats;
+  const uint8_t *ksrc = (const uint8_t *) &kstats;
+  size_t left = sizeof kstats;
+
+  if(!thread_get_stats(tid, &kstats))
+    return false;
+
+  //copy a page at a time, since the buffer must be writable, not
+  //just mapped
+  while(left > 0){
+    size_t page_left = PGSIZE - pg_ofs(udst);
+    size_t copy_amt = left < page_left ? left : page_left;
+
+    if(!pin_page(udst, true))
+      thread_exit();
+    memcpy(udst, ksrc, copy_amt);
+    unpin_page(udst);
+    udst += copy_amt;
+    ksrc += copy_amt;
+    left -= copy_amt;
+  }
+  return true;
+}
+
+#ifdef VM
+/*Removes mapping M from the process, writing its dirty pages back
+to the file, and closes the file.*/
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  list_remove(&m->elem);
+  for(i = 0; i < m->page_cnt; i++)
+    page_deallocate(m->base + i * PGSIZE);
+  lock_acquire(&file_sys_lock);
+  file_close(m->file);
+  lock_release(&file_sys_lock);
+  free(m);
+}
+
+/*Maps the file open as fd into the process's address space,
+starting at page-aligned address addr.  Pages are read in on first
+touch and dirty pages are written back when they are evicted, on
+munmap, and at exit; the tail of the last page past end of file
+reads as zeros and is never written back.  Returns a mapping id,
+or -1 if the file is empty or a directory, or if addr is null,
+misaligned or overlaps pages already in use.*/
+static int sys_mmap (int handle, void *addr){
+  struct file_descriptor *fd = find_fd(handle);
+  struct thread *cur = thread_current();
+  struct mapping *m;
+  off_t length, ofs;
+
+  if(addr == NULL || pg_ofs(addr) != 0
+     || inode_is_dir(file_get_inode(fd->file)))
+    return -1;
+
+  m = malloc(sizeof *m);
+  if(m == NULL)
+    return -1;
+  lock_acquire(&file_sys_lock);
+  m->file = file_reopen(fd->file);
+  length = m->file != NULL ? file_length(m->file) : 0;
+  lock_release(&file_sys_lock);
+  if(m->file == NULL){
+    free(m);
+    return -1;
+  }
+  m->handle = cur->next_handle++;
+  m->base = addr;
+  m->page_cnt = 0;
+  list_push_front(&cur->mappings, &m->elem);
+
+  if(length == 0){
+    unmap(m);
+    return -1;
+  }
+  for(ofs = 0; ofs < length; ofs += PGSIZE){
+    uint8_t *upage = m->base + ofs;
+    struct page *p;
+
+    /*A page that is mapped without a supplemental page, such
+    as part of a large page, is in use too.*/
+    if(!is_user_vaddr(upage)
+       || pagedir_get_page(cur->pagedir, upage) != NULL
+       || (p = page_allocate(upage, false)) == NULL){
+      unmap(m);
+      return -1;
+    }
+    p->private = false;
+    p->file = m->file;
+    p->file_offset = ofs;
+    p->file_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+    m->page_cnt++;
+  }
+  return m->handle;
+}
+
+/*Unmaps the mapping with id mapping, which must not have been
+unmapped already, writing any dirty pages back to its file.*/
+static int sys_munmap (int mapping){
+  struct list *s = &thread_current()->mappings;
+  struct list_elem *e;
+
+  for(e = list_begin(s); e != list_end(s); e = list_next(e)){
+    struct mapping *m = list_entry(e, struct mapping, elem);
+    if(m->handle == mapping){
+      unmap(m);
+      return 0;
+    }
+  }
+  thread_exit();
+}
+
+/*Creates a copy of the calling process, which entered the kernel
+with registers F.  Returns the child's pid in the parent and 0 in
+the child, or -1 if the child could not be created.*/
+static int sys_fork (struct intr_frame *f){
+  return process_fork(f);
+}
+#endif
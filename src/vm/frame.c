@@ -0,0 +1,604 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every user page that is in memory occupies a frame, which
+   records the page it holds.  After a fork, several processes'
+   copies of a page may share one read-only frame until one of
+   them writes to it; the frame then lists all of them, and
+   evicting it evicts every one.  Frames are taken from the user
+   pool as needed.  Once the pool will give no more, a frame is
+   reclaimed from some page by the "clock" (second chance)
+   algorithm: a hand sweeps the circular list of frames, clearing
+   each page's accessed bit as it passes, and evicts the first
+   page it finds that has not been accessed since the previous
+   sweep.
+
+   A frame's lock is held while its page is being read in or
+   written out and while a system call has the page pinned for
+   I/O.  The hand skips over frames whose lock is busy, so
+   eviction never waits on a frame.  SCAN_LOCK protects the list
+   and the hand.
+
+   A thread in frame_lock() may be waiting for the lock of a
+   frame that is meanwhile evicted, given to another page, and
+   freed.  So that the lock stays valid memory, a struct frame is
+   never freed: frame_free() returns only its page to the user
+   pool and keeps the struct in SPARE_FRAMES for reuse.
+
+   Eviction normally happens ahead of time, in the "pager"
+   thread.  When the frames that could be handed out without
+   evicting, counting both the user pool and the pager's reserve
+   of evicted frames, drop below a low watermark, the pager wakes
+   and runs the clock until a high watermark is restored.  It
+   evicts up to SWAP_BATCH frames at a time, so that their pages
+   can be written to swap together.  A process that finds both
+   empty evicts a page itself.
+
+   Frames holding read-only pages of files, which in practice
+   means program text, are also entered in the "text frame" table
+   under the inode, offset, and length they hold.  A process that
+   runs a program already running elsewhere finds its code pages
+   there and shares their frames instead of reading its own
+   copies.  A frame leaves the table when it is freed or evicted.
+   TEXT_LOCK protects the table; it may be acquired with a frame
+   locked, but not the other way around, so lookups only try to
+   lock the frames they find.
+
+   The zero frame is a page of zeros that any number of pages
+   that have not been written yet may map read-only.  It is
+   never on the clock list, so it is never evicted or freed, and
+   it always counts as shared, so that writing to one of its
+   pages gives the page a copy of its own. */
+
+static struct lock scan_lock;
+static struct list frame_list;          /* All frames, in clock order. */
+static struct list spare_frames;        /* Freed frames, without pages. */
+static struct list_elem *hand;          /* Next frame to consider. */
+static size_t frame_cnt;                /* Number of frames. */
+
+/* Page-out daemon.  The pager evicts frames ahead of demand into
+   FREE_FRAMES, which like the rest of the frame table is
+   protected by SCAN_LOCK. */
+static struct list free_frames;         /* Evicted, ready frames. */
+static size_t free_frame_cnt;           /* Length of FREE_FRAMES. */
+static size_t pager_low;                /* Wake the pager below this. */
+static size_t pager_high;               /* Pager stops at this. */
+static struct semaphore pager_wake;     /* Upped to wake the pager. */
+static bool pager_started;              /* Pager thread is running. */
+static bool pager_busy;                 /* Pager has been woken. */
+
+static thread_func pager NO_RETURN;
+
+static struct kmem_cache *frame_cache;
+
+static struct frame zero_frame;         /* Shared page of zeros. */
+
+static struct lock text_lock;
+static struct hash text_frames;         /* Shareable read-only frames. */
+
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* Statistics. */
+static size_t frame_peak;               /* Maximum of FRAME_CNT. */
+static unsigned long long evict_cnt;    /* Pages chosen for eviction. */
+static unsigned long long evict_fail_cnt; /* Allocations that failed. */
+static unsigned long long reserve_hit_cnt; /* Frames from FREE_FRAMES. */
+static unsigned long long pager_run_cnt;  /* Times the pager woke. */
+static unsigned long long pager_evict_cnt; /* Frames the pager evicted. */
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  lock_init (&scan_lock);
+  list_init (&frame_list);
+  list_init (&free_frames);
+  list_init (&spare_frames);
+  hand = list_end (&frame_list);
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), 0, NULL);
+  lock_init (&text_lock);
+  hash_init (&text_frames, text_hash, text_less, NULL);
+
+  lock_init (&zero_frame.lock);
+  list_init (&zero_frame.pages);
+  zero_frame.base = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Removes frame F, which must be locked, from the text frame
+   table, if it is there. */
+static void
+text_remove (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  if (f->inode != NULL)
+    {
+      lock_acquire (&text_lock);
+      hash_delete (&text_frames, &f->text_elem);
+      lock_release (&text_lock);
+      f->inode = NULL;
+    }
+}
+
+/* Moves the hand to the next frame, wrapping around.  The scan
+   lock must be held. */
+static struct frame *
+advance_hand (void)
+{
+  struct frame *f;
+
+  if (hand == list_end (&frame_list))
+    hand = list_begin (&frame_list);
+  f = list_entry (hand, struct frame, elem);
+  hand = list_next (hand);
+  return f;
+}
+
+/* Puts frame F, which must be locked, just behind the hand, so
+   that it is the last to be considered for eviction, and makes
+   it hold PAGE. */
+static void
+insert_frame (struct frame *f, struct page *page)
+{
+  list_init (&f->pages);
+  frame_share (f, page);
+
+  lock_acquire (&scan_lock);
+  list_insert (hand, &f->elem);
+  if (++frame_cnt > frame_peak)
+    frame_peak = frame_cnt;
+  lock_release (&scan_lock);
+}
+
+/* Returns a new, locked frame for PAGE taken from the pager's
+   reserve or from the user pool, or a null pointer if both are
+   exhausted. */
+static struct frame *
+new_frame (struct page *page)
+{
+  struct frame *f = NULL;
+  void *base;
+
+  lock_acquire (&scan_lock);
+  if (!list_empty (&free_frames))
+    {
+      f = list_entry (list_pop_front (&free_frames), struct frame, elem);
+      free_frame_cnt--;
+      reserve_hit_cnt++;
+    }
+  lock_release (&scan_lock);
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      insert_frame (f, page);
+      return f;
+    }
+
+  base = palloc_get_page (PAL_USER);
+  if (base == NULL)
+    return NULL;
+  lock_acquire (&scan_lock);
+  if (!list_empty (&spare_frames))
+    f = list_entry (list_pop_front (&spare_frames), struct frame, elem);
+  lock_release (&scan_lock);
+  if (f == NULL)
+    {
+      f = kmem_cache_alloc (frame_cache);
+      if (f == NULL)
+        {
+          palloc_free_page (base);
+          return NULL;
+        }
+      lock_init (&f->lock);
+    }
+
+  lock_acquire (&f->lock);
+  f->base = base;
+  f->inode = NULL;
+  insert_frame (f, page);
+  return f;
+}
+
+/* Sweeps the clock hand, giving each page a second chance, and
+   returns the first frame whose pages have not been accessed
+   since the last sweep, locked, or a null pointer if there is
+   none. */
+static struct frame *
+pick_victim (void)
+{
+  size_t i;
+
+  lock_acquire (&scan_lock);
+  for (i = 0; i < frame_cnt * 2; i++)
+    {
+      struct frame *f = advance_hand ();
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        continue;
+
+      if (page_accessed_recently (f))
+        {
+          lock_release (&f->lock);
+          continue;
+        }
+
+      evict_cnt++;
+      lock_release (&scan_lock);
+      return f;
+    }
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Returns the number of frames that could be handed out without
+   evicting anything. */
+static size_t
+free_frames_available (void)
+{
+  return free_frame_cnt + palloc_available (PAL_USER);
+}
+
+/* Wakes the pager if free frames have run low. */
+static void
+check_free_frames (void)
+{
+  bool wake = false;
+
+  if (!pager_started || free_frames_available () >= pager_low)
+    return;
+  lock_acquire (&scan_lock);
+  if (!pager_busy)
+    {
+      pager_busy = wake = true;
+      pager_run_cnt++;
+    }
+  lock_release (&scan_lock);
+  if (wake)
+    sema_up (&pager_wake);
+}
+
+/* Tries to allocate and lock a frame for PAGE, evicting another
+   page if necessary.  Returns the frame if successful, a null
+   pointer on failure. */
+static struct frame *
+try_frame_alloc_and_lock (struct page *page)
+{
+  struct frame *f = new_frame (page);
+
+  check_free_frames ();
+  if (f != NULL)
+    return f;
+
+  /* The pager has not kept up.  Evict a page ourselves. */
+  f = pick_victim ();
+  if (f == NULL)
+    return NULL;
+  if (!page_out (f))
+    {
+      lock_release (&f->lock);
+      return NULL;
+    }
+
+  text_remove (f);
+  list_init (&f->pages);
+  frame_share (f, page);
+  return f;
+}
+
+/* Moves frame F, which must be locked and evicted, from the
+   clock list to the pager's reserve, and unlocks it. */
+static void
+reserve_frame (struct frame *f)
+{
+  text_remove (f);
+
+  lock_acquire (&scan_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  list_push_back (&free_frames, &f->elem);
+  free_frame_cnt++;
+  pager_evict_cnt++;
+  lock_release (&scan_lock);
+  lock_release (&f->lock);
+}
+
+/* Evicts up to SWAP_BATCH frames, but no more than WANT, in a
+   single batch and puts them in the reserve.  Returns true if
+   all of the frames chosen were evicted, false if there were
+   none to choose or any of them could not be evicted. */
+static bool
+pager_evict_batch (size_t want)
+{
+  struct frame *batch[SWAP_BATCH];
+  bool ok[SWAP_BATCH];
+  size_t cnt = 0;
+  bool all_ok = true;
+  size_t i;
+
+  while (cnt < SWAP_BATCH && cnt < want)
+    {
+      struct frame *f = pick_victim ();
+      if (f == NULL)
+        break;
+      batch[cnt++] = f;
+    }
+  if (cnt == 0)
+    return false;
+
+  page_out_batch (batch, cnt, ok);
+  for (i = 0; i < cnt; i++)
+    if (ok[i])
+      reserve_frame (batch[i]);
+    else
+      {
+        lock_release (&batch[i]->lock);
+        all_ok = false;
+      }
+  return all_ok;
+}
+
+/* Page-out daemon.  Whenever it is woken, evicts frames until at
+   least PAGER_HIGH could be handed out without evicting, and
+   keeps them in the reserve for new_frame(). */
+static void
+pager (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&pager_wake);
+      for (;;)
+        {
+          size_t avail = free_frames_available ();
+          if (avail >= pager_high || !pager_evict_batch (pager_high - avail))
+            break;
+        }
+
+      lock_acquire (&scan_lock);
+      pager_busy = false;
+      lock_release (&scan_lock);
+    }
+}
+
+/* Starts the pager thread.  It keeps at least 1/64 of the user
+   pages that are free now ready to hand out, and evicts up to
+   twice that many at a time. */
+void
+frame_start_pager (void)
+{
+  pager_low = palloc_available (PAL_USER) / 64 + 1;
+  pager_high = pager_low * 2;
+  sema_init (&pager_wake, 0);
+  pager_started = true;
+  thread_create ("pager", PRI_DEFAULT + 1, pager, NULL);
+}
+
+/* Tries really hard to allocate and lock a frame for PAGE.
+   Returns the frame if successful, a null pointer on failure. */
+struct frame *
+frame_alloc_and_lock (struct page *page)
+{
+  size_t try;
+
+  for (try = 0; try < 3; try++)
+    {
+      struct frame *f = try_frame_alloc_and_lock (page);
+      if (f != NULL)
+        {
+          ASSERT (lock_held_by_current_thread (&f->lock));
+          return f;
+        }
+      timer_msleep (1000);
+    }
+
+  lock_acquire (&scan_lock);
+  evict_fail_cnt++;
+  lock_release (&scan_lock);
+  return NULL;
+}
+
+/* Allocates and locks a frame for PAGE if one is free without
+   evicting anything and without drawing the free frames below
+   the pager's low watermark, for reading pages in ahead of need.
+   Returns the frame if successful, a null pointer otherwise. */
+struct frame *
+frame_alloc_if_free (struct page *page)
+{
+  struct frame *f;
+
+  if (free_frames_available () <= pager_low)
+    return NULL;
+  f = new_frame (page);
+  check_free_frames ();
+  return f;
+}
+
+/* Locks P's frame into memory, if it has one.  Upon return,
+   p->frame will not change until P is unlocked. */
+void
+frame_lock (struct page *p)
+{
+  /* A frame can be asynchronously removed, but never inserted. */
+  struct frame *f = p->frame;
+  if (f != NULL)
+    {
+      lock_acquire (&f->lock);
+      if (f != p->frame)
+        {
+          lock_release (&f->lock);
+          ASSERT (p->frame == NULL);
+        }
+    }
+}
+
+/* Releases frame F, which must be locked and hold no page but
+   its owner's, giving its page back to the user pool.  The
+   struct itself is kept for reuse. */
+void
+frame_free (struct frame *f)
+{
+  void *base = f->base;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  text_remove (f);
+  lock_acquire (&scan_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  frame_cnt--;
+  list_push_back (&spare_frames, &f->elem);
+  lock_release (&scan_lock);
+
+  /* Once F is unlocked, new_frame() may reuse it, so don't touch
+     it again. */
+  lock_release (&f->lock);
+  palloc_free_page (base);
+}
+
+/* Adds page P, which must not have a frame, to the pages held
+   in frame F.  F must be locked. */
+void
+frame_share (struct frame *f, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (p->frame == NULL || p->frame == f);
+
+  list_push_back (&f->pages, &p->frame_elem);
+  p->frame = f;
+}
+
+/* Removes page P from the pages held in frame F, which must be
+   locked.  F must hold some other page too. */
+void
+frame_unshare (struct frame *f, struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (p->frame == f);
+  ASSERT (frame_is_shared (f));
+
+  list_remove (&p->frame_elem);
+  p->frame = NULL;
+}
+
+/* Returns true if more than one page shares frame F, or if F is
+   the zero frame. */
+bool
+frame_is_shared (struct frame *f)
+{
+  return (f == &zero_frame
+          || list_begin (&f->pages) != list_rbegin (&f->pages));
+}
+
+/* Adds page P, which must not have a frame, to the zero frame,
+   and returns the zero frame locked. */
+struct frame *
+frame_get_zero (struct page *p)
+{
+  lock_acquire (&zero_frame.lock);
+  frame_share (&zero_frame, p);
+  return &zero_frame;
+}
+
+/* Looks for a frame in the text frame table that holds BYTES
+   bytes of INODE starting at offset OFS, followed by zeros.
+   Returns it locked, or a null pointer if there is none or it is
+   busy. */
+struct frame *
+frame_text_lookup (struct inode *inode, off_t ofs, off_t bytes)
+{
+  struct frame key;
+  struct frame *f = NULL;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  key.file_offset = ofs;
+  key.file_bytes = bytes;
+
+  lock_acquire (&text_lock);
+  e = hash_find (&text_frames, &key.text_elem);
+  if (e != NULL)
+    {
+      f = hash_entry (e, struct frame, text_elem);
+      if (lock_held_by_current_thread (&f->lock)
+          || !lock_try_acquire (&f->lock))
+        f = NULL;
+    }
+  lock_release (&text_lock);
+  return f;
+}
+
+/* Enters frame F, which must be locked and hold BYTES bytes of
+   INODE starting at offset OFS followed by zeros, in the text
+   frame table, unless another frame already holds the same
+   data.  The data must never change while F is in the table. */
+void
+frame_text_insert (struct frame *f, struct inode *inode, off_t ofs,
+                   off_t bytes)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  ASSERT (f->inode == NULL);
+
+  f->inode = inode;
+  f->file_offset = ofs;
+  f->file_bytes = bytes;
+  lock_acquire (&text_lock);
+  if (hash_insert (&text_frames, &f->text_elem) != NULL)
+    f->inode = NULL;
+  lock_release (&text_lock);
+}
+
+/* Unlocks frame F, allowing it to be evicted.
+   F must be locked for use by the current process. */
+void
+frame_unlock (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&f->lock));
+  lock_release (&f->lock);
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frame: %zu frames (peak %zu), %llu evictions, "
+          "%llu failed allocations\n",
+          frame_cnt, frame_peak, evict_cnt, evict_fail_cnt);
+  printf ("Frame: pager woke %llu times, evicted %llu frames, "
+          "%zu in reserve, %llu allocations from reserve\n",
+          pager_run_cnt, pager_evict_cnt, free_frame_cnt, reserve_hit_cnt);
+}
+
+/* Returns a hash value for text frame F_. */
+static unsigned
+text_hash (const struct hash_elem *f_, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (f_, struct frame, text_elem);
+  return hash_bytes (&f->inode, sizeof f->inode) ^ hash_int (f->file_offset);
+}
+
+/* Returns true if text frame A_ precedes text frame B_. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, text_elem);
+  const struct frame *b = hash_entry (b_, struct frame, text_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  if (a->file_offset != b->file_offset)
+    return a->file_offset < b->file_offset;
+  return a->file_bytes < b->file_bytes;
+}
@@ -0,0 +1,50 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct inode;
+struct page;
+
+/* A physical frame holding a user page. */
+struct frame
+  {
+    struct lock lock;           /* Held while pinned or being evicted. */
+    void *base;                 /* Kernel virtual base address. */
+    struct list pages;          /* Pages sharing the frame, protected
+                                   by LOCK. */
+    struct list_elem elem;      /* Element in the clock list. */
+
+    /* Read-only file contents, for sharing with other processes
+       that map the same part of the same file. */
+    struct inode *inode;        /* Inode, or null if not shareable. */
+    off_t file_offset;          /* Offset in file. */
+    off_t file_bytes;           /* Bytes from file, 0...PGSIZE. */
+    struct hash_elem text_elem; /* Element in the text frame table. */
+  };
+
+void frame_init (void);
+void frame_start_pager (void);
+
+struct frame *frame_alloc_and_lock (struct page *);
+struct frame *frame_alloc_if_free (struct page *);
+void frame_lock (struct page *);
+void frame_unlock (struct frame *);
+void frame_free (struct frame *);
+
+void frame_share (struct frame *, struct page *);
+void frame_unshare (struct frame *, struct page *);
+bool frame_is_shared (struct frame *);
+struct frame *frame_get_zero (struct page *);
+
+struct frame *frame_text_lookup (struct inode *, off_t ofs, off_t bytes);
+void frame_text_insert (struct frame *, struct inode *, off_t ofs,
+                        off_t bytes);
+
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,969 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process keeps a hash table, keyed by user virtual page
+   address, that describes every page of its address space: where
+   its contents live while it is not in memory, and which frame
+   holds it while it is.  load() records each page of an
+   executable's segments here instead of reading it in, and
+   page_in() fills the page and maps it the first time the
+   process touches it, so a program pays only for the pages it
+   uses.
+
+   The stack starts out as a single page and grows on demand: a
+   fault on a missing page at or just below the user stack
+   pointer, within PAGE_STACK_LIMIT bytes of the top of user
+   memory, gets a new zeroed page.  "Just below" allows for the
+   32 bytes that PUSHA checks before it moves the stack pointer.
+   A fault taken in the kernel, while a system call touches a
+   user buffer, compares against the user stack pointer saved at
+   system call entry.
+
+   fork() copies a process's table into the child's.  Pages that
+   are in memory are shared copy-on-write: the parent's and
+   child's pages share one frame, mapped read-only in both, and
+   the first write by either one faults into page_copy_on_write(),
+   which gives the writer a copy of its own.  Pages in swap share
+   their swap slot, and the rest are read in from the same place
+   by each process.
+
+   A page of zeros, such as BSS or new stack, that is read before
+   it is written maps the frame table's single zero frame, which
+   counts as always shared.  The first write then copies it just
+   like a page shared by fork.
+
+   Read-only file pages, which hold program text, are shared more
+   widely: a process that faults one in first looks for a frame
+   that another process already read it into, through the frame
+   table's text frame table, and maps that frame if there is
+   one.  Executables are denied writes while they run, so the
+   contents cannot go stale.
+
+   When memory runs out, the frame table evicts a frame with
+   page_out(), together with every page that shares it, or
+   several frames at once with page_out_batch().  A page that is
+   clean is simply dropped, since it can be read from its file or
+   zero-filled again.  A dirty page of a memory-mapped file is
+   written back to the file; any other dirty page is written to
+   swap and read back from there next time.  A batch goes to swap
+   sorted by process and address, so that neighbouring pages land
+   in neighbouring slots, and reading one of them back in also
+   reads in the pages of the same process that follow it in swap,
+   as long as there are frames to spare.
+
+   A fault on a page that comes from a file also maps some of the
+   following pages of the same file, as long as they can be had
+   cheaply: from the text frame table, or read into frames that
+   are free without evicting anything.  How many depends on a
+   window kept per file, for a few files per process, that
+   adapts to how well it has been doing: at each fault, if at
+   least half of the pages mapped around the previous fault in
+   the file have been accessed since, the window doubles, up to
+   FAULT_AROUND_MAX pages, and otherwise it halves.  With nothing
+   mapped around the previous fault, the window grows if the new
+   fault is on the very next page.  A sequential scan thus takes
+   few faults, and random access soon stops reading pages it
+   does not need.
+
+   Pages are read and written with file_read_at() and
+   file_write_at(), which leave the file position alone, without
+   taking the system call file system lock.  Eviction can happen
+   in the middle of a system call that already holds the lock, so
+   it must not wait for it.  This is safe because executables are
+   denied writes while they run and a mapping never extends its
+   file, so page I/O never changes the file system's
+   metadata. */
+
+static struct kmem_cache *page_cache;
+
+/* Fault-around. */
+#define FAULT_WINDOWS 4         /* Files tracked per process. */
+#define FAULT_AROUND_INIT 4     /* Initial window, in pages. */
+#define FAULT_AROUND_MAX 32     /* Maximum window, in pages. */
+
+/* Fault-around state for one file in a process. */
+struct fault_window
+  {
+    struct file *file;          /* File, or null if unused. */
+    uint8_t *last;              /* Page of the last fault in FILE. */
+    size_t batch_cnt;           /* Pages mapped after LAST. */
+    size_t size;                /* Pages to try to map next time. */
+  };
+
+/* -stack: Maximum size of a process's stack, in bytes. */
+size_t page_stack_limit = 8 * 1024 * 1024;
+
+/* Statistics. */
+static unsigned long long file_page_cnt;    /* Pages read from files. */
+static unsigned long long zero_page_cnt;    /* Zero-filled pages. */
+static unsigned long long zero_share_cnt;   /* Zero frame mappings. */
+static unsigned long long drop_cnt;         /* Clean pages dropped. */
+static unsigned long long write_back_cnt;   /* Pages written to files. */
+static unsigned long long stack_grow_cnt;   /* Stack pages added. */
+static unsigned long long fork_share_cnt;   /* Frames shared by fork. */
+static unsigned long long cow_copy_cnt;     /* Pages copied on write,
+                                               including the zero
+                                               frame. */
+static unsigned long long text_share_cnt;   /* Text frames found shared. */
+static unsigned long long read_around_cnt;  /* Pages read in from swap
+                                               along with another. */
+static unsigned long long fault_around_cnt; /* Pages mapped around
+                                               faults. */
+static unsigned long long fault_around_hit_cnt; /* Those found used at
+                                                   the next fault. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static bool map_page (struct page *, bool dirty);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+}
+
+/* Creates an empty supplemental page table for the current
+   process.  Returns true if successful, false if memory
+   allocation failed. */
+bool
+page_table_create (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->pages == NULL);
+  t->pages = malloc (sizeof *t->pages);
+  if (t->pages == NULL)
+    return false;
+  hash_init (t->pages, page_hash, page_less, NULL);
+  return true;
+}
+
+/* Destroys page P_, which must be in the current process,
+   freeing its frame and swap slot, as a hash table destructor.
+   A memory-mapped file page is first written back to its file
+   if it is dirty. */
+static void
+destroy_page (struct hash_elem *p_, void *aux UNUSED)
+{
+  struct page *p = hash_entry (p_, struct page, hash_elem);
+
+  frame_lock (p);
+  if (p->frame != NULL)
+    {
+      struct frame *f = p->frame;
+      pagedir_clear_page (p->thread->pagedir, p->addr);
+      if (frame_is_shared (f))
+        {
+          frame_unshare (f, p);
+          frame_unlock (f);
+        }
+      else
+        {
+          /* The page goes away even if writing it back fails, so
+             don't use page_out(), which would map it again. */
+          if (p->file != NULL && !p->private
+              && pagedir_is_dirty (p->thread->pagedir, p->addr))
+            {
+              file_write_at (p->file, f->base, p->file_bytes,
+                             p->file_offset);
+              write_back_cnt++;
+            }
+          frame_free (f);
+        }
+    }
+  swap_discard (p);
+  kmem_cache_free (page_cache, p);
+}
+
+/* Destroys the current process's supplemental page table,
+   along with the frames and swap slots its pages occupy.
+   Dirty memory-mapped file pages are written back. */
+void
+page_exit (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->pages != NULL)
+    {
+      hash_destroy (t->pages, destroy_page);
+      free (t->pages);
+      t->pages = NULL;
+    }
+  free (t->fault_windows);
+  t->fault_windows = NULL;
+}
+
+/* Copies the supplemental page table of PARENT, which must be
+   blocked, into the current process's, for fork().  Pages that
+   PARENT has in memory are shared copy-on-write and pages in swap
+   share their slot.  A page that comes from OLD_EXEC comes from
+   NEW_EXEC in the copy.  Memory-mapped file pages are not copied.
+   Returns true if successful, false if memory allocation
+   failed. */
+bool
+page_table_fork (struct thread *parent, struct file *old_exec,
+                 struct file *new_exec)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  struct hash_iterator i;
+
+  hash_first (&i, parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *p;
+      struct frame *f;
+
+      if (pp->file != NULL && !pp->private)
+        continue;
+      p = page_allocate (pp->addr, pp->read_only);
+      if (p == NULL)
+        return false;
+      p->file = pp->file == old_exec ? new_exec : pp->file;
+      p->file_offset = pp->file_offset;
+      p->file_bytes = pp->file_bytes;
+
+      frame_lock (pp);
+      f = pp->frame;
+      if (f != NULL)
+        {
+          /* Map the frame read-only in both processes.  The
+             child's copy of the page is exactly as dirty as the
+             parent's. */
+          if (!pagedir_set_page (pd, p->addr, f->base, false))
+            {
+              frame_unlock (f);
+              return false;
+            }
+          if (pagedir_is_dirty (parent->pagedir, pp->addr))
+            pagedir_set_dirty (pd, p->addr, true);
+          pagedir_set_writable (parent->pagedir, pp->addr, false);
+          frame_share (f, p);
+          fork_share_cnt++;
+          frame_unlock (f);
+        }
+      else if (pp->sector != (block_sector_t) -1)
+        swap_share (p, pp);
+    }
+  return true;
+}
+
+/* Adds a page at user virtual address VADDR to the current
+   process's supplemental page table, initially zero-filled.
+   The caller may then set up its file backing.  Returns the new
+   page, or a null pointer if VADDR is already in use or memory
+   allocation fails. */
+struct page *
+page_allocate (void *vaddr, bool read_only)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (vaddr) == 0);
+  ASSERT (is_user_vaddr (vaddr));
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return NULL;
+  p->addr = vaddr;
+  p->read_only = read_only;
+  p->thread = t;
+  p->frame = NULL;
+  p->sector = (block_sector_t) -1;
+  p->file = NULL;
+  p->file_offset = 0;
+  p->file_bytes = 0;
+  p->private = true;
+
+  if (hash_insert (t->pages, &p->hash_elem) != NULL)
+    {
+      kmem_cache_free (page_cache, p);
+      return NULL;
+    }
+  return p;
+}
+
+/* Removes the page at VADDR from the current process's
+   supplemental page table and frees it, writing it back to its
+   file first if it is a dirty memory-mapped file page. */
+void
+page_deallocate (void *vaddr)
+{
+  struct page *p = page_for_addr (vaddr);
+
+  ASSERT (p != NULL);
+  hash_delete (thread_current ()->pages, &p->hash_elem);
+  destroy_page (&p->hash_elem, NULL);
+}
+
+/* Returns the current process's page that contains ADDRESS, or
+   a null pointer if there is none. */
+struct page *
+page_for_addr (const void *address)
+{
+  struct thread *t = thread_current ();
+  struct page p;
+  struct hash_elem *e;
+
+  if (t->pages == NULL || !is_user_vaddr (address))
+    return NULL;
+
+  p.addr = pg_round_down (address);
+  e = hash_find (t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Returns the current process's page that contains ADDRESS,
+   like page_for_addr(), but if there is none and ADDRESS looks
+   like a stack access, adds a new stack page for it.  Returns a
+   null pointer if ADDRESS is not part of the address space. */
+static struct page *
+page_for_fault (const void *address)
+{
+  struct thread *t = thread_current ();
+  struct page *p = page_for_addr (address);
+  uint8_t *esp = t->user_esp;
+
+  if (p == NULL && t->pages != NULL
+      && (uint8_t *) address >= (uint8_t *) PHYS_BASE - page_stack_limit
+      && (uint8_t *) address >= esp - 32
+      && pagedir_get_page (t->pagedir, address) == NULL)
+    {
+      p = page_allocate (pg_round_down (address), false);
+      if (p != NULL)
+        stack_grow_cnt++;
+    }
+  return p;
+}
+
+/* Reads in from swap as many as possible of the CNT pages in
+   PAGES, which belong to the current process and were found in
+   the swap slots that follow the one at SECTOR, and maps them,
+   stopping when no frame is available without evicting another
+   page.  A page that is no longer evicted to the slot it was
+   found in is skipped. */
+static void
+read_around (struct page *pages[], size_t cnt, block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct page *p = pages[i];
+
+      ASSERT (p->thread == thread_current ());
+      sector += PGSIZE / BLOCK_SECTOR_SIZE;
+      if (p->frame != NULL || p->sector != sector)
+        continue;
+      p->frame = frame_alloc_if_free (p);
+      if (p->frame == NULL)
+        break;
+
+      /* Map the page before reading it, because once its swap
+         slot is gone its dirty bit is all that keeps it from
+         being dropped. */
+      if (!map_page (p, true))
+        {
+          frame_free (p->frame);
+          p->frame = NULL;
+          break;
+        }
+      swap_in (p);
+      frame_unlock (p->frame);
+      read_around_cnt++;
+    }
+}
+
+/* Returns true if page P, which is not in memory, is read-only
+   file contents that other processes can share. */
+static bool
+is_text (const struct page *p)
+{
+  return (p->read_only && p->file != NULL
+          && p->sector == (block_sector_t) -1);
+}
+
+/* Reads page P's contents from its file into its frame, which
+   must be locked, and makes the frame shareable if P is text.
+   Returns true if successful; otherwise, frees P's frame and
+   returns false. */
+static bool
+read_file_page (struct page *p)
+{
+  off_t read_bytes = file_read_at (p->file, p->frame->base,
+                                   p->file_bytes, p->file_offset);
+  if (read_bytes != p->file_bytes)
+    {
+      frame_free (p->frame);
+      p->frame = NULL;
+      return false;
+    }
+  memset ((uint8_t *) p->frame->base + read_bytes, 0, PGSIZE - read_bytes);
+  file_page_cnt++;
+  if (is_text (p))
+    frame_text_insert (p->frame, file_get_inode (p->file),
+                       p->file_offset, p->file_bytes);
+  return true;
+}
+
+/* Locks a frame for page P and fills it with P's contents.
+   Sets *DIRTY to true if the contents no longer match P's file
+   or zeros, which is the case for a page read back from swap.
+   Unless WRITE is true, a page of zeros gets the shared zero
+   frame.  Returns true if successful, false on failure, in which
+   case P is left without a frame. */
+static bool
+do_page_in (struct page *p, bool *dirty, bool write)
+{
+  bool text = is_text (p);
+
+  /* A page of zeros that is only being read can share the zero
+     frame until it is first written. */
+  *dirty = false;
+  if (!write && p->file == NULL && p->sector == (block_sector_t) -1)
+    {
+      frame_get_zero (p);
+      zero_share_cnt++;
+      return true;
+    }
+
+  /* Share the frame of another process's copy of a text page. */
+  if (text)
+    {
+      struct frame *f = frame_text_lookup (file_get_inode (p->file),
+                                           p->file_offset, p->file_bytes);
+      if (f != NULL)
+        {
+          frame_share (f, p);
+          text_share_cnt++;
+          return true;
+        }
+    }
+
+  /* Get a frame for the page. */
+  p->frame = frame_alloc_and_lock (p);
+  if (p->frame == NULL)
+    return false;
+
+  /* Copy data into the frame. */
+  if (p->sector != (block_sector_t) -1)
+    {
+      struct page *around[SWAP_BATCH - 1];
+      size_t around_cnt = swap_read_around (p, around, SWAP_BATCH - 1);
+      block_sector_t sector = p->sector;
+
+      swap_in (p);
+      *dirty = true;
+      read_around (around, around_cnt, sector);
+    }
+  else if (p->file != NULL)
+    {
+      if (!read_file_page (p))
+        return false;
+    }
+  else
+    {
+      memset (p->frame->base, 0, PGSIZE);
+      zero_page_cnt++;
+    }
+  return true;
+}
+
+/* Returns true if page P, which must have a frame, may be
+   mapped writable.  A page in a shared frame may not, so that a
+   write to it faults into page_copy_on_write(). */
+static bool
+page_writable (struct page *p)
+{
+  return !p->read_only && !frame_is_shared (p->frame);
+}
+
+/* Maps page P, whose frame is locked, into its process's page
+   directory, marking it dirty if DIRTY.  Returns true if
+   successful, false if memory allocation failed. */
+static bool
+map_page (struct page *p, bool dirty)
+{
+  uint32_t *pd = p->thread->pagedir;
+
+  if (pagedir_get_page (pd, p->addr) != NULL)
+    return true;
+  if (!pagedir_set_page (pd, p->addr, p->frame->base, page_writable (p)))
+    return false;
+  if (dirty)
+    pagedir_set_dirty (pd, p->addr, true);
+  return true;
+}
+
+/* Returns the current process's fault-around window for FILE,
+   making it the most recently used, or a null pointer if memory
+   allocation failed.  A file without a window takes over the
+   least recently used one. */
+static struct fault_window *
+get_fault_window (struct file *file)
+{
+  struct thread *t = thread_current ();
+  struct fault_window w;
+  size_t i;
+
+  if (t->fault_windows == NULL)
+    {
+      t->fault_windows = calloc (FAULT_WINDOWS, sizeof *t->fault_windows);
+      if (t->fault_windows == NULL)
+        return NULL;
+    }
+
+  for (i = 0; i < FAULT_WINDOWS - 1; i++)
+    if (t->fault_windows[i].file == file)
+      break;
+  w = t->fault_windows[i];
+  if (w.file != file)
+    {
+      w.file = file;
+      w.last = NULL;
+      w.batch_cnt = 0;
+      w.size = FAULT_AROUND_INIT;
+    }
+  memmove (t->fault_windows + 1, t->fault_windows,
+           i * sizeof *t->fault_windows);
+  t->fault_windows[0] = w;
+  return &t->fault_windows[0];
+}
+
+/* Maps page P, the page after the one faulted in, which is not
+   in memory, if that is cheap: if it is text that another
+   process has in memory, or if a frame is free without evicting
+   anything.  Returns true if successful, false otherwise. */
+static bool
+map_around (struct page *p)
+{
+  if (is_text (p))
+    {
+      struct frame *f = frame_text_lookup (file_get_inode (p->file),
+                                           p->file_offset, p->file_bytes);
+      if (f != NULL)
+        {
+          frame_share (f, p);
+          text_share_cnt++;
+        }
+    }
+  if (p->frame == NULL)
+    {
+      p->frame = frame_alloc_if_free (p);
+      if (p->frame == NULL || !read_file_page (p))
+        return false;
+    }
+  if (!map_page (p, false))
+    {
+      /* P is clean, so it can stay in its frame unmapped. */
+      frame_unlock (p->frame);
+      return false;
+    }
+  frame_unlock (p->frame);
+  return true;
+}
+
+/* Having just read page P in from its file for a fault, adjusts
+   the fault-around window for P's file and maps as many of the
+   pages that follow P in the file as it allows. */
+static void
+fault_around (struct page *p)
+{
+  struct fault_window *w = get_fault_window (p->file);
+  uint32_t *pd = p->thread->pagedir;
+  uint8_t *addr = p->addr;
+  bool grow;
+  size_t i;
+
+  if (w == NULL)
+    return;
+
+  /* Judge the last batch by how many of its pages were used. */
+  if (w->batch_cnt > 0)
+    {
+      size_t hits = 0;
+
+      for (i = 1; i <= w->batch_cnt; i++)
+        if (pagedir_is_accessed (pd, w->last + i * PGSIZE))
+          hits++;
+      fault_around_hit_cnt += hits;
+      grow = hits * 2 >= w->batch_cnt;
+    }
+  else
+    grow = w->last != NULL && addr == w->last + PGSIZE;
+  if (grow)
+    w->size = w->size == 0 ? 1 : w->size * 2;
+  else
+    w->size /= 2;
+  if (w->size > FAULT_AROUND_MAX)
+    w->size = FAULT_AROUND_MAX;
+
+  /* Map the following pages, up to the end of the window or the
+     first page that does not continue P's part of the file. */
+  w->last = addr;
+  w->batch_cnt = 0;
+  for (i = 1; i <= w->size; i++)
+    {
+      struct page *q = page_for_addr (addr + i * PGSIZE);
+
+      if (q == NULL || q->file != p->file
+          || q->file_offset != p->file_offset + (off_t) (i * PGSIZE)
+          || q->private != p->private
+          || q->frame != NULL || q->sector != (block_sector_t) -1
+          || !map_around (q))
+        break;
+      w->batch_cnt++;
+      fault_around_cnt++;
+    }
+}
+
+/* Brings in the page containing FAULT_ADDR, which the page
+   directory does not map.  WRITE should be true if the access
+   was a write.  Returns true if successful, false if FAULT_ADDR
+   is not part of the process's address space or the page could
+   not be loaded. */
+bool
+page_in (void *fault_addr, bool write)
+{
+  struct page *p;
+  bool dirty = false;
+  bool from_file;
+  bool success;
+
+  p = page_for_fault (fault_addr);
+  if (p == NULL)
+    return false;
+
+  frame_lock (p);
+  from_file = (p->frame == NULL && p->file != NULL
+               && p->sector == (block_sector_t) -1);
+  if (p->frame == NULL && !do_page_in (p, &dirty, write))
+    return false;
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+
+  success = map_page (p, dirty);
+  frame_unlock (p->frame);
+  if (success && from_file)
+    fault_around (p);
+  return success;
+}
+
+/* Gives page P, whose frame is locked, a frame of its own if it
+   shares one, and maps it writable.  On return P's frame, which
+   may be a new one, is locked instead.  Returns true if
+   successful, false if memory allocation failed. */
+static bool
+make_writable (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  struct frame *old = p->frame;
+  struct frame *f;
+
+  ASSERT (!p->read_only);
+
+  if (!frame_is_shared (old))
+    {
+      pagedir_set_writable (pd, p->addr, true);
+      return true;
+    }
+
+  frame_unshare (old, p);
+  f = frame_alloc_and_lock (p);
+  if (f == NULL)
+    {
+      frame_share (old, p);
+      return false;
+    }
+  memcpy (f->base, old->base, PGSIZE);
+  frame_unlock (old);
+  cow_copy_cnt++;
+
+  pagedir_clear_page (pd, p->addr);
+  return map_page (p, true);
+}
+
+/* Handles a write to the present, read-only page containing
+   FAULT_ADDR by giving the process its own copy of the page, if
+   it shares it with a forked process.  Returns true if
+   successful, false if the page is really read-only or memory
+   allocation failed. */
+bool
+page_copy_on_write (void *fault_addr)
+{
+  struct page *p = page_for_addr (fault_addr);
+  bool success;
+
+  if (p == NULL || p->read_only)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL)
+    {
+      /* Evicted since the fault.  Retrying the write will fault
+         the page back in, writable if it is no longer shared. */
+      return true;
+    }
+  success = make_writable (p);
+  frame_unlock (p->frame);
+  return success;
+}
+
+/* Marks the pages in frame F, which must be locked, not present
+   in their page tables, forcing accesses to fault, and returns
+   true if any of them is dirty.  The pages must be unmapped
+   before checking the dirty bits, to prevent a race with a
+   process dirtying a page. */
+static bool
+unmap_frame (struct frame *f)
+{
+  struct list_elem *e;
+  bool dirty = false;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      pagedir_clear_page (p->thread->pagedir, p->addr);
+      if (pagedir_is_dirty (p->thread->pagedir, p->addr))
+        dirty = true;
+    }
+  return dirty;
+}
+
+/* Finishes evicting frame F after unmap_frame().  If OK, the
+   pages in F no longer have a frame; otherwise, they are mapped
+   again, dirty, since their contents were not saved. */
+static void
+finish_page_out (struct frame *f, bool ok)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      uint32_t *pd = p->thread->pagedir;
+
+      if (ok)
+        {
+          /* Record the slot while P still has its frame, since
+             once it does not its process may page it back in. */
+          if (p->sector != (block_sector_t) -1)
+            swap_evicted (p);
+          p->frame = NULL;
+        }
+      else if (pagedir_set_page (pd, p->addr, f->base, page_writable (p)))
+        pagedir_set_dirty (pd, p->addr, true);
+    }
+}
+
+/* Returns true if frame A should go to swap ahead of frame B, so
+   that the pages of one process go to adjacent slots in address
+   order. */
+static bool
+swap_order_less (struct frame *a, struct frame *b)
+{
+  struct page *pa = list_entry (list_front (&a->pages),
+                                struct page, frame_elem);
+  struct page *pb = list_entry (list_front (&b->pages),
+                                struct page, frame_elem);
+
+  if (pa->thread != pb->thread)
+    return pa->thread < pb->thread;
+  return pa->addr < pb->addr;
+}
+
+/* Evicts the CNT frames in FRAMES, at most SWAP_BATCH, each of
+   which must be locked, along with every page that shares each
+   one.  If none of a frame's pages is dirty, they are dropped; a
+   dirty memory-mapped file page is written back to its file; and
+   any other dirty frames are written to swap together.  Sets
+   OK[I] to true if FRAMES[I] was evicted, false on failure, in
+   which case its pages stay in it. */
+void
+page_out_batch (struct frame *frames[], size_t cnt, bool ok[])
+{
+  struct frame *swap_frames[SWAP_BATCH];
+  size_t swap_idx[SWAP_BATCH];
+  bool swap_ok[SWAP_BATCH];
+  size_t swap_cnt = 0;
+  size_t i, j;
+
+  ASSERT (cnt <= SWAP_BATCH);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = frames[i];
+      struct page *first = list_entry (list_front (&f->pages),
+                                       struct page, frame_elem);
+
+      if (!unmap_frame (f))
+        {
+          drop_cnt++;
+          ok[i] = true;
+        }
+      else if (first->file != NULL && !first->private)
+        {
+          /* Memory-mapped file pages are never shared. */
+          ok[i] = (file_write_at (first->file, f->base, first->file_bytes,
+                                  first->file_offset)
+                   == first->file_bytes);
+          write_back_cnt++;
+        }
+      else
+        {
+          /* Insertion sort into swap order. */
+          for (j = swap_cnt; j > 0 && swap_order_less (f, swap_frames[j - 1]);
+               j--)
+            {
+              swap_frames[j] = swap_frames[j - 1];
+              swap_idx[j] = swap_idx[j - 1];
+            }
+          swap_frames[j] = f;
+          swap_idx[j] = i;
+          swap_cnt++;
+        }
+    }
+
+  if (swap_cnt > 0)
+    {
+      swap_out_batch (swap_frames, swap_cnt, swap_ok);
+      for (j = 0; j < swap_cnt; j++)
+        ok[swap_idx[j]] = swap_ok[j];
+    }
+
+  for (i = 0; i < cnt; i++)
+    finish_page_out (frames[i], ok[i]);
+}
+
+/* Evicts frame F, which must be locked, along with every page
+   that shares it, as for page_out_batch().  Returns true if
+   successful, false on failure, in which case the pages stay in
+   F. */
+bool
+page_out (struct frame *f)
+{
+  bool ok;
+
+  page_out_batch (&f, 1, &ok);
+  return ok;
+}
+
+/* Returns true if any page in frame F has been accessed
+   recently, false otherwise, and clears their accessed bits
+   either way.  F must be locked. */
+bool
+page_accessed_recently (struct frame *f)
+{
+  struct list_elem *e;
+  bool was_accessed = false;
+
+  ASSERT (lock_held_by_current_thread (&f->lock));
+
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      if (pagedir_is_accessed (p->thread->pagedir, p->addr))
+        {
+          pagedir_set_accessed (p->thread->pagedir, p->addr, false);
+          was_accessed = true;
+        }
+    }
+  return was_accessed;
+}
+
+/* Makes sure the page containing ADDR is in memory and mapped,
+   and pins it there until page_unlock() so that a system call
+   can touch it without faulting.  If WILL_WRITE is true, the
+   page must be writable.  Returns true if successful, false if
+   ADDR is not in the process's address space or the page could
+   not be loaded.  A page that will be written is given a copy of
+   its own first if it is shared copy-on-write, since the kernel
+   may not fault on it while it is pinned.  A page mapped outside
+   the supplemental page table, such as a large page, is always in
+   memory and never writable. */
+bool
+page_lock (const void *addr, bool will_write)
+{
+  struct page *p = page_for_fault (addr);
+  bool dirty = false;
+
+  if (p == NULL)
+    return (!will_write && is_user_vaddr (addr)
+            && pagedir_get_page (thread_current ()->pagedir, addr) != NULL);
+  if (p->read_only && will_write)
+    return false;
+
+  frame_lock (p);
+  if (p->frame == NULL && !do_page_in (p, &dirty, will_write))
+    return false;
+  if (!map_page (p, dirty) || (will_write && !make_writable (p)))
+    {
+      frame_unlock (p->frame);
+      return false;
+    }
+  return true;
+}
+
+/* Unlocks a page locked with page_lock(). */
+void
+page_unlock (const void *addr)
+{
+  struct page *p = page_for_addr (addr);
+
+  if (p != NULL)
+    {
+      ASSERT (p->frame != NULL);
+      frame_unlock (p->frame);
+    }
+}
+
+/* Prints supplemental page table statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Page: %llu pages read from files, %llu zero-filled, "
+          "%llu clean pages dropped, %llu written back to files, "
+          "%llu stack pages added\n",
+          file_page_cnt, zero_page_cnt, drop_cnt, write_back_cnt,
+          stack_grow_cnt);
+  printf ("Page: %llu frames shared by fork, %llu pages copied on write, "
+          "%llu text frames shared, %llu zero frame mappings\n",
+          fork_share_cnt, cow_copy_cnt, text_share_cnt, zero_share_cnt);
+  printf ("Page: %llu pages read around from swap, "
+          "%llu pages mapped around faults (%llu used)\n",
+          read_around_cnt, fault_around_cnt, fault_around_hit_cnt);
+}
+
+/* Returns a hash value for the page that P_ refers to. */
+static unsigned
+page_hash (const struct hash_elem *p_, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (p_, struct page, hash_elem);
+  return ((uintptr_t) p->addr) >> PGBITS;
+}
+
+/* Returns true if page A_ precedes page B_. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->addr < b->addr;
+}
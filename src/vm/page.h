@@ -0,0 +1,65 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Virtual page in a process's supplemental page table. */
+struct page
+  {
+    void *addr;                 /* User virtual address. */
+    bool read_only;             /* Read-only page? */
+    struct thread *thread;      /* Owning thread. */
+    struct hash_elem hash_elem; /* Element in thread's `pages' table. */
+
+    /* Set only in owning process context with frame->lock held.
+       Cleared only with frame->lock held. */
+    struct frame *frame;        /* Page frame, or null. */
+    struct list_elem frame_elem; /* Element in frame's `pages' list. */
+
+    /* Swap information, protected by frame->lock. */
+    block_sector_t sector;      /* Starting sector of swap area, or -1. */
+
+    /* Backing file.  If FILE is null, the page starts out
+       zeroed; otherwise its first FILE_BYTES bytes come from
+       FILE at FILE_OFFSET and the rest are zeroed.  A page that
+       is not PRIVATE is a memory-mapped file page, whose changes
+       are written back to FILE. */
+    struct file *file;          /* File, or null. */
+    off_t file_offset;          /* Offset in file. */
+    off_t file_bytes;           /* Bytes to read/write, 0...PGSIZE. */
+    bool private;               /* False to write back to file. */
+  };
+
+/* Maximum size of a process's stack, in bytes. */
+extern size_t page_stack_limit;
+
+struct file;
+struct frame;
+struct thread;
+
+void page_init (void);
+bool page_table_create (void);
+void page_exit (void);
+bool page_table_fork (struct thread *parent, struct file *old_exec,
+                      struct file *new_exec);
+
+struct page *page_allocate (void *, bool read_only);
+void page_deallocate (void *);
+struct page *page_for_addr (const void *);
+bool page_in (void *fault_addr, bool write);
+bool page_copy_on_write (void *fault_addr);
+bool page_out (struct frame *);
+void page_out_batch (struct frame *[], size_t cnt, bool ok[]);
+bool page_accessed_recently (struct frame *);
+
+bool page_lock (const void *, bool will_write);
+void page_unlock (const void *);
+
+void page_print_stats (void);
+
+#endif /* vm/page.h */
@@ -0,0 +1,292 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/zswap.h"
+
+/* Swap space.
+
+   The BLOCK_SWAP device is divided into page-size "slots", and a
+   bitmap records which slots hold a page.  A page that is written
+   out keeps its slot until it is read back in or its process
+   exits.  A frame shared by a forked parent and child is written
+   out once, and all of its pages then share the slot, which is
+   freed when the last of them lets go of it.
+
+   The pager evicts several frames at a time and writes them out
+   together, through swap_out_batch(), to a run of adjacent slots
+   in order of process and address, so that the disk sees one
+   sequential write instead of scattered ones.  Each slot held by
+   a single page remembers that page, and when a process reads a
+   page back in, swap_read_around() finds the pages of the same
+   process in the slots that follow it, which were most likely
+   written out together with it, so that they can be read in
+   with it while the disk head is already there.
+
+   Slots are read and written through the compressed swap cache
+   in zswap.c, which keeps as many of them in memory as it can
+   and only sends the coldest ones to the swap device. */
+
+/* The swap device. */
+static struct block *swap_device;
+
+/* Used swap slots. */
+static struct bitmap *swap_bitmap;
+
+/* Number of pages that refer to each slot. */
+static unsigned *slot_refs;
+
+/* The page in each slot, if exactly one page refers to it, it
+   has been written out, and it has not been read back in,
+   otherwise a null pointer.  A page found here may still have
+   its frame for a moment, until its eviction finishes. */
+static struct page **slot_owner;
+
+/* Protects SWAP_BITMAP, SLOT_REFS, SLOT_OWNER, and the
+   statistics. */
+static struct lock swap_lock;
+
+/* Number of sectors per page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Statistics. */
+static unsigned long long swap_in_cnt;  /* Pages read from swap. */
+static unsigned long long swap_out_cnt; /* Pages written to swap. */
+static unsigned long long batch_cnt;    /* Batches written to adjacent
+                                           slots. */
+static size_t slots_used;               /* Slots in use. */
+static size_t slots_peak;               /* Maximum of SLOTS_USED. */
+
+/* Sets up swap. */
+void
+swap_init (void)
+{
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    {
+      printf ("no swap device--swap disabled\n");
+      swap_bitmap = bitmap_create (0);
+    }
+  else
+    swap_bitmap = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  if (swap_bitmap == NULL)
+    PANIC ("couldn't create swap bitmap");
+  slot_refs = calloc (bitmap_size (swap_bitmap), sizeof *slot_refs);
+  slot_owner = calloc (bitmap_size (swap_bitmap), sizeof *slot_owner);
+  if ((slot_refs == NULL || slot_owner == NULL)
+      && bitmap_size (swap_bitmap) > 0)
+    PANIC ("couldn't allocate swap slot table");
+  lock_init (&swap_lock);
+  zswap_init (swap_device, bitmap_size (swap_bitmap));
+}
+
+/* Reads page P back in from swap into its frame and frees its
+   swap slot.  P's frame must be locked. */
+void
+swap_in (struct page *p)
+{
+  size_t i;
+
+  ASSERT (p->frame != NULL);
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (block_sector_t) -1);
+
+  if (!zswap_load (p->sector / PAGE_SECTORS, p->frame->base))
+    for (i = 0; i < PAGE_SECTORS; i++)
+      block_read (swap_device, p->sector + i,
+                  (uint8_t *) p->frame->base + i * BLOCK_SECTOR_SIZE);
+  swap_discard (p);
+  lock_acquire (&swap_lock);
+  swap_in_cnt++;
+  lock_release (&swap_lock);
+}
+
+/* Returns a free swap slot, marking it used, or BITMAP_ERROR if
+   swap is full.  The swap lock must be held. */
+static size_t
+alloc_slot (void)
+{
+  size_t slot = bitmap_scan_and_flip_next (swap_bitmap, 1, false);
+  if (slot != BITMAP_ERROR)
+    slots_used++;
+  return slot;
+}
+
+/* Writes the contents of frame F, which must be locked, to swap
+   slot SLOT, which all of the pages in F then refer to. */
+static void
+write_slot (struct frame *f, size_t slot)
+{
+  block_sector_t sector = slot * PAGE_SECTORS;
+  struct list_elem *e;
+  size_t i;
+
+  if (!zswap_store (slot, f->base))
+    for (i = 0; i < PAGE_SECTORS; i++)
+      block_write (swap_device, sector + i,
+                   (uint8_t *) f->base + i * BLOCK_SECTOR_SIZE);
+  for (e = list_begin (&f->pages); e != list_end (&f->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, frame_elem);
+      ASSERT (p->sector == (block_sector_t) -1);
+      p->sector = sector;
+    }
+}
+
+/* Writes the contents of the CNT frames in FRAMES, at most
+   SWAP_BATCH, each of which must be locked, out to free swap
+   slots, adjacent ones if possible, in the order given.  The
+   pages in each frame then refer to its slot.  Sets OK[I] to
+   true if FRAMES[I] was written, false if swap was full. */
+void
+swap_out_batch (struct frame *frames[], size_t cnt, bool ok[])
+{
+  size_t slots[SWAP_BATCH];
+  size_t first;
+  size_t i;
+
+  ASSERT (cnt <= SWAP_BATCH);
+
+  lock_acquire (&swap_lock);
+  first = (cnt > 1
+           ? bitmap_scan_and_flip_next (swap_bitmap, cnt, false)
+           : BITMAP_ERROR);
+  if (first != BITMAP_ERROR)
+    {
+      slots_used += cnt;
+      batch_cnt++;
+    }
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f = frames[i];
+
+      ASSERT (lock_held_by_current_thread (&f->lock));
+      slots[i] = first != BITMAP_ERROR ? first + i : alloc_slot ();
+      ok[i] = slots[i] != BITMAP_ERROR;
+      if (ok[i])
+        {
+          swap_out_cnt++;
+          slot_refs[slots[i]] = list_size (&f->pages);
+        }
+    }
+  if (slots_used > slots_peak)
+    slots_peak = slots_used;
+  lock_release (&swap_lock);
+
+  for (i = 0; i < cnt; i++)
+    if (ok[i])
+      write_slot (frames[i], slots[i]);
+}
+
+/* Records page P, which has just been written out to its swap
+   slot, as the page in the slot if it is the only one, so that
+   swap_read_around() can find it.  P's frame must be locked.
+   This must wait until P's contents are in the slot, not happen
+   as the slot is allocated, or P could be read in from a slot
+   it has not been written to. */
+void
+swap_evicted (struct page *p)
+{
+  size_t slot = p->sector / PAGE_SECTORS;
+
+  ASSERT (lock_held_by_current_thread (&p->frame->lock));
+  ASSERT (p->sector != (block_sector_t) -1);
+
+  lock_acquire (&swap_lock);
+  if (slot_refs[slot] == 1)
+    slot_owner[slot] = p;
+  lock_release (&swap_lock);
+}
+
+/* Finds pages of the same process as page P, which must have a
+   swap slot, in the slots that directly follow P's, up to MAX of
+   them, stopping at the first slot that holds none.  Stores them
+   in PAGES, in slot order, and returns the number found.  They
+   are good candidates to read in along with P. */
+size_t
+swap_read_around (const struct page *p, struct page *pages[], size_t max)
+{
+  size_t slot;
+  size_t cnt = 0;
+
+  ASSERT (p->sector != (block_sector_t) -1);
+
+  lock_acquire (&swap_lock);
+  for (slot = p->sector / PAGE_SECTORS + 1;
+       cnt < max && slot < bitmap_size (swap_bitmap); slot++)
+    {
+      struct page *q = slot_owner[slot];
+      if (q == NULL || q->thread != p->thread)
+        break;
+      pages[cnt++] = q;
+    }
+  lock_release (&swap_lock);
+  return cnt;
+}
+
+/* Makes page P, which must not have a swap slot, refer to the
+   same swap slot as page FROM. */
+void
+swap_share (struct page *p, const struct page *from)
+{
+  ASSERT (p->sector == (block_sector_t) -1);
+  ASSERT (from->sector != (block_sector_t) -1);
+
+  lock_acquire (&swap_lock);
+  slot_refs[from->sector / PAGE_SECTORS]++;
+  slot_owner[from->sector / PAGE_SECTORS] = NULL;
+  lock_release (&swap_lock);
+  p->sector = from->sector;
+}
+
+/* Drops page P's reference to its swap slot, if it has one,
+   freeing the slot if no other page refers to it. */
+void
+swap_discard (struct page *p)
+{
+  size_t slot;
+  bool last;
+
+  if (p->sector == (block_sector_t) -1)
+    return;
+
+  slot = p->sector / PAGE_SECTORS;
+  lock_acquire (&swap_lock);
+  ASSERT (slot_refs[slot] > 0);
+  if (slot_owner[slot] == p)
+    slot_owner[slot] = NULL;
+  last = --slot_refs[slot] == 0;
+  lock_release (&swap_lock);
+  p->sector = (block_sector_t) -1;
+
+  /* Drop the slot's cached contents before the slot can be
+     reused. */
+  if (last)
+    {
+      zswap_discard (slot);
+      lock_acquire (&swap_lock);
+      bitmap_reset (swap_bitmap, slot);
+      slots_used--;
+      lock_release (&swap_lock);
+    }
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  if (swap_bitmap == NULL)
+    return;
+  printf ("Swap: %llu pages in, %llu pages out "
+          "(%llu batches to adjacent slots), "
+          "%zu of %zu slots used (peak %zu)\n",
+          swap_in_cnt, swap_out_cnt, batch_cnt, slots_used,
+          bitmap_size (swap_bitmap), slots_peak);
+}
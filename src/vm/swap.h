@@ -0,0 +1,23 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Maximum number of frames written out by one call to
+   swap_out_batch(). */
+#define SWAP_BATCH 8
+
+struct frame;
+struct page;
+
+void swap_init (void);
+void swap_in (struct page *);
+void swap_out_batch (struct frame *[], size_t cnt, bool ok[]);
+void swap_evicted (struct page *);
+size_t swap_read_around (const struct page *, struct page *[], size_t max);
+void swap_share (struct page *, const struct page *);
+void swap_discard (struct page *);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */
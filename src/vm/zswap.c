@@ -0,0 +1,358 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Compressed swap cache.
+
+   Swap slots are written to and read from here first.  A page
+   written to a slot is compressed and kept in memory, in a pool
+   of kernel pages, instead of going to the swap device, unless
+   it does not compress to 3/4 of a page or less.  Reading the
+   slot back decompresses it, which is much faster than a disk
+   read.  The slot on the swap device is still reserved for the
+   page, so that it can go there later.
+
+   Each pool page is divided into 64-byte chunks, and a
+   compressed page takes a run of consecutive chunks within one
+   pool page.  When the pool is at its limit, or the page
+   allocator will give it no more pages, room is made by writing
+   the least recently used compressed pages back to their slots
+   on the swap device.  The pool also gives pages back this way
+   when the page allocator runs short.
+
+   ZSWAP_LOCK protects everything here.  It is held while a
+   compressed page is written back, so that a slot being read is
+   either still in the cache or already on disk. */
+
+#define CHUNK_SIZE 64                   /* Bytes per chunk. */
+#define PAGE_CHUNKS (PGSIZE / CHUNK_SIZE) /* Chunks per pool page. */
+#define MAX_BLOB (PGSIZE / 4 * 3)       /* Largest compressed page kept. */
+#define MAX_WRITE_BACKS 8               /* Most write-backs per store. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A pool page. */
+struct zpage
+  {
+    void *base;                 /* Kernel virtual address. */
+    uint64_t used;              /* Bit I set if chunk I is in use. */
+    size_t free_cnt;            /* Number of chunks not in use. */
+    struct list_elem elem;      /* Element in POOL. */
+  };
+
+/* A compressed page. */
+struct blob
+  {
+    size_t slot;                /* Swap slot. */
+    struct zpage *zpage;        /* Pool page holding the data. */
+    size_t chunk;               /* First chunk in ZPAGE. */
+    size_t size;                /* Compressed size, in bytes. */
+    struct list_elem lru_elem;  /* Element in LRU. */
+  };
+
+/* -zswap: Maximum number of pool pages, or SIZE_MAX to choose a
+   limit based on the amount of memory. */
+size_t zswap_limit = SIZE_MAX;
+
+static struct lock zswap_lock;
+static struct block *swap_device;
+static struct blob **slot_blobs;        /* Blob for each slot, or null. */
+static struct list pool;                /* All pool pages. */
+static size_t pool_pages;               /* Length of POOL. */
+static struct list lru;                 /* Blobs, least recent first. */
+static struct kmem_cache *blob_cache;
+
+/* Page-sized buffers. */
+static void *work;                      /* Compressor scratch. */
+static void *compressed;                /* Compressor output. */
+static void *plain;                     /* Page being written back. */
+
+/* Statistics. */
+static unsigned long long store_cnt;    /* Pages compressed and kept. */
+static unsigned long long reject_cnt;   /* Pages that didn't compress. */
+static unsigned long long load_cnt;     /* Pages read from the cache. */
+static unsigned long long write_back_cnt; /* Pages written to disk. */
+static size_t blob_cnt;                 /* Compressed pages kept. */
+static size_t blob_bytes;               /* Total size of kept pages. */
+static size_t pool_peak;                /* Maximum of POOL_PAGES. */
+
+static palloc_reclaim_func zswap_reclaim;
+
+/* Sets up the compressed swap cache in front of the SLOT_CNT
+   swap slots on DEVICE. */
+void
+zswap_init (struct block *device, size_t slot_cnt)
+{
+  lock_init (&zswap_lock);
+  list_init (&pool);
+  list_init (&lru);
+  if (zswap_limit == SIZE_MAX)
+    zswap_limit = palloc_available (PAL_USER) / 4;
+  if (device == NULL || slot_cnt == 0 || zswap_limit == 0)
+    return;
+
+  swap_device = device;
+  slot_blobs = calloc (slot_cnt, sizeof *slot_blobs);
+  if (slot_blobs == NULL)
+    PANIC ("couldn't allocate compressed swap cache");
+  blob_cache = kmem_cache_create ("zswap blob", sizeof (struct blob),
+                                  0, NULL);
+  ASSERT (LZ_WORK_SIZE <= PGSIZE);
+  work = palloc_get_page (PAL_ASSERT);
+  compressed = palloc_get_page (PAL_ASSERT);
+  plain = palloc_get_page (PAL_ASSERT);
+  palloc_add_reclaim (zswap_reclaim);
+}
+
+/* Returns a mask of CNT chunk bits starting at chunk FIRST. */
+static uint64_t
+chunk_mask (size_t first, size_t cnt)
+{
+  uint64_t bits = cnt < 64 ? ((uint64_t) 1 << cnt) - 1 : ~(uint64_t) 0;
+  return bits << first;
+}
+
+/* Returns the data of blob B. */
+static void *
+blob_data (const struct blob *b)
+{
+  return (uint8_t *) b->zpage->base + b->chunk * CHUNK_SIZE;
+}
+
+/* Finds CNT consecutive free chunks in the pool, adding a pool
+   page if necessary and allowed, and marks them used.  Stores
+   their pool page in *ZPAGE and the first of them in *CHUNK.
+   Returns true if successful, false if there is no room. */
+static bool
+alloc_chunks (size_t cnt, struct zpage **zpage, size_t *chunk)
+{
+  struct list_elem *e;
+  struct zpage *zp;
+
+  for (e = list_begin (&pool); e != list_end (&pool); e = list_next (e))
+    {
+      size_t i;
+
+      zp = list_entry (e, struct zpage, elem);
+      if (zp->free_cnt < cnt)
+        continue;
+      for (i = 0; i + cnt <= PAGE_CHUNKS; i++)
+        if ((zp->used & chunk_mask (i, cnt)) == 0)
+          {
+            zp->used |= chunk_mask (i, cnt);
+            zp->free_cnt -= cnt;
+            *zpage = zp;
+            *chunk = i;
+            return true;
+          }
+    }
+
+  if (pool_pages >= zswap_limit)
+    return false;
+  zp = malloc (sizeof *zp);
+  if (zp == NULL)
+    return false;
+  zp->base = palloc_get_page (0);
+  if (zp->base == NULL)
+    {
+      free (zp);
+      return false;
+    }
+  zp->used = chunk_mask (0, cnt);
+  zp->free_cnt = PAGE_CHUNKS - cnt;
+  list_push_back (&pool, &zp->elem);
+  if (++pool_pages > pool_peak)
+    pool_peak = pool_pages;
+  *zpage = zp;
+  *chunk = 0;
+  return true;
+}
+
+/* Removes blob B from the cache and frees it, along with its
+   pool page if that leaves the page empty.  Returns true if a
+   pool page was freed. */
+static bool
+free_blob (struct blob *b)
+{
+  struct zpage *zp = b->zpage;
+  size_t cnt = DIV_ROUND_UP (b->size, CHUNK_SIZE);
+
+  slot_blobs[b->slot] = NULL;
+  list_remove (&b->lru_elem);
+  blob_cnt--;
+  blob_bytes -= b->size;
+  zp->used &= ~chunk_mask (b->chunk, cnt);
+  zp->free_cnt += cnt;
+  kmem_cache_free (blob_cache, b);
+
+  if (zp->free_cnt < PAGE_CHUNKS)
+    return false;
+  list_remove (&zp->elem);
+  pool_pages--;
+  palloc_free_page (zp->base);
+  free (zp);
+  return true;
+}
+
+/* Writes the least recently used blob back to its slot on the
+   swap device and frees it.  Returns true if a pool page was
+   freed.  The cache must not be empty. */
+static bool
+write_back_oldest (void)
+{
+  struct blob *b = list_entry (list_front (&lru), struct blob, lru_elem);
+  size_t size;
+  size_t i;
+
+  size = lz_decompress (blob_data (b), b->size, plain, PGSIZE);
+  ASSERT (size == PGSIZE);
+  for (i = 0; i < PAGE_SECTORS; i++)
+    block_write (swap_device, b->slot * PAGE_SECTORS + i,
+                 (uint8_t *) plain + i * BLOCK_SECTOR_SIZE);
+  write_back_cnt++;
+  return free_blob (b);
+}
+
+/* Compresses PAGE and keeps it in the cache as the contents of
+   swap slot SLOT.  Returns true if successful, false if PAGE
+   did not compress well or there was no room, in which case the
+   caller must write it to the swap device itself. */
+bool
+zswap_store (size_t slot, const void *page)
+{
+  struct blob *b;
+  struct zpage *zp;
+  size_t chunk;
+  size_t size;
+  size_t i;
+
+  if (slot_blobs == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (slot_blobs[slot] == NULL);
+  size = lz_compress (page, PGSIZE, compressed, MAX_BLOB, work);
+  if (size == 0)
+    {
+      reject_cnt++;
+      lock_release (&zswap_lock);
+      return false;
+    }
+
+  /* Make room, writing back old pages if necessary. */
+  b = kmem_cache_alloc (blob_cache);
+  if (b == NULL)
+    {
+      lock_release (&zswap_lock);
+      return false;
+    }
+  for (i = 0; !alloc_chunks (DIV_ROUND_UP (size, CHUNK_SIZE), &zp, &chunk);
+       i++)
+    {
+      if (i >= MAX_WRITE_BACKS || list_empty (&lru))
+        {
+          kmem_cache_free (blob_cache, b);
+          lock_release (&zswap_lock);
+          return false;
+        }
+      write_back_oldest ();
+    }
+
+  b->slot = slot;
+  b->zpage = zp;
+  b->chunk = chunk;
+  b->size = size;
+  memcpy (blob_data (b), compressed, size);
+  slot_blobs[slot] = b;
+  list_push_back (&lru, &b->lru_elem);
+  store_cnt++;
+  blob_cnt++;
+  blob_bytes += size;
+  lock_release (&zswap_lock);
+  return true;
+}
+
+/* Reads the contents of swap slot SLOT into PAGE if the cache
+   holds them.  Returns true if so, false if the caller must read
+   the slot from the swap device. */
+bool
+zswap_load (size_t slot, void *page)
+{
+  struct blob *b;
+  size_t size;
+
+  if (slot_blobs == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  b = slot_blobs[slot];
+  if (b == NULL)
+    {
+      lock_release (&zswap_lock);
+      return false;
+    }
+  size = lz_decompress (blob_data (b), b->size, page, PGSIZE);
+  ASSERT (size == PGSIZE);
+  list_remove (&b->lru_elem);
+  list_push_back (&lru, &b->lru_elem);
+  load_cnt++;
+  lock_release (&zswap_lock);
+  return true;
+}
+
+/* Drops the cached contents of swap slot SLOT, if any, because
+   the slot is being freed. */
+void
+zswap_discard (size_t slot)
+{
+  if (slot_blobs == NULL)
+    return;
+
+  lock_acquire (&zswap_lock);
+  if (slot_blobs[slot] != NULL)
+    free_blob (slot_blobs[slot]);
+  lock_release (&zswap_lock);
+}
+
+/* Page allocator reclaim function: writes back the least
+   recently used compressed pages until PAGE_CNT pool pages have
+   been freed or the cache is empty.  Does nothing if the cache
+   is busy, which includes the case where it is the cache itself
+   that is allocating.  Returns the number of pages freed. */
+static size_t
+zswap_reclaim (enum palloc_flags flags UNUSED, size_t page_cnt)
+{
+  size_t freed = 0;
+
+  if (lock_held_by_current_thread (&zswap_lock)
+      || !lock_try_acquire (&zswap_lock))
+    return 0;
+  while (freed < page_cnt && !list_empty (&lru))
+    if (write_back_oldest ())
+      freed++;
+  lock_release (&zswap_lock);
+  return freed;
+}
+
+/* Prints compressed swap cache statistics. */
+void
+zswap_print_stats (void)
+{
+  if (slot_blobs == NULL)
+    return;
+  printf ("Zswap: %llu pages stored, %llu incompressible, "
+          "%llu loaded, %llu written back\n",
+          store_cnt, reject_cnt, load_cnt, write_back_cnt);
+  printf ("Zswap: %zu pages in %zu bytes, "
+          "%zu of %zu pool pages used (peak %zu)\n",
+          blob_cnt, blob_bytes, pool_pages, zswap_limit, pool_peak);
+}
@@ -0,0 +1,18 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct block;
+
+/* Maximum number of kernel pages to hold compressed pages. */
+extern size_t zswap_limit;
+
+void zswap_init (struct block *, size_t slot_cnt);
+bool zswap_store (size_t slot, const void *page);
+bool zswap_load (size_t slot, void *page);
+void zswap_discard (size_t slot);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */